@@ -0,0 +1,144 @@
+#pragma once
+#ifndef FINALIZER_HPP
+#define FINALIZER_HPP
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <utility>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+//! Represents a background queue of job finalization steps, e.g. uploads, database updates, notification emails and cleanups.
+//! The steps are run in order by a dedicated thread, so that the compute threads can proceed to the next job immediately.
+//! A failed step is retried with exponential backoff. Once it has failed all its attempts, the remaining steps of its job are abandoned.
+//! The final steps of a job, e.g. marking it as completed, run regardless, and are told which step was abandoned, if any.
+class finalizer
+{
+public:
+	//! Represents a step, which returns true on success. Exceptions count as failures.
+	typedef std::function<bool()> step;
+
+	//! Represents a final step, which is given the failure that abandoned the steps of its job, or an empty string, and returns true on success.
+	typedef std::function<bool(const std::string& failure)> final_step;
+
+	//! Starts the finalizer thread. Failures are reported to the given logger.
+	explicit finalizer(const std::function<void(const std::string&)>& log, const size_t max_attempts = 5, const std::chrono::milliseconds initial_delay = std::chrono::seconds(5)) : log(log), max_attempts(max_attempts), initial_delay(initial_delay), stopping(false)
+	{
+		worker = std::thread([this]()
+		{
+			run();
+		});
+	}
+
+	//! Calls finish().
+	~finalizer()
+	{
+		finish();
+	}
+
+	//! Runs the queued steps to completion and joins the finalizer thread. No more jobs may be posted afterwards.
+	void finish()
+	{
+		{
+			std::lock_guard<std::mutex> guard(m);
+			stopping = true;
+		}
+		cv.notify_all();
+		if (worker.joinable()) worker.join();
+	}
+
+	//! Queues the named steps of a job, followed by the named final steps that always run.
+	void post(const std::string& job, std::vector<std::pair<std::string, step>> steps, std::vector<std::pair<std::string, final_step>> final_steps = {})
+	{
+		{
+			std::lock_guard<std::mutex> guard(m);
+			jobs.push_back({ job, std::move(steps), std::move(final_steps) });
+		}
+		cv.notify_all();
+	}
+
+	//! Returns the number of jobs queued or being finalized.
+	size_t pending() const
+	{
+		std::lock_guard<std::mutex> guard(m);
+		return jobs.size();
+	}
+
+private:
+	//! Finalizes queued jobs one by one until stopped and drained.
+	void run()
+	{
+		while (true)
+		{
+			std::unique_lock<std::mutex> lock(m);
+			cv.wait(lock, [this]() { return !jobs.empty() || stopping; });
+			if (jobs.empty()) return;
+			auto& job = jobs.front();
+			lock.unlock();
+			std::string failure;
+			for (const auto& s : job.steps)
+			{
+				if (!attempt(job.name, s.first, s.second))
+				{
+					log("Abandoned finalizing job " + job.name + " after " + std::to_string(max_attempts) + " failed attempts to " + s.first);
+					failure = "Failed to " + s.first;
+					break;
+				}
+			}
+			for (const auto& s : job.final_steps)
+			{
+				if (!attempt(job.name, s.first, [&]() { return s.second(failure); }))
+				{
+					log("Gave up after " + std::to_string(max_attempts) + " failed attempts to " + s.first + " for job " + job.name);
+				}
+			}
+			lock.lock();
+			jobs.pop_front();
+		}
+	}
+
+	//! Runs a step until it succeeds or has failed max_attempts times, doubling the delay between attempts. Returns true on success.
+	bool attempt(const std::string& job, const std::string& name, const step& s) const
+	{
+		auto delay = initial_delay;
+		for (size_t i = 1;; ++i)
+		{
+			try
+			{
+				if (s()) return true;
+				log("Failed to " + name + " for job " + job + " in attempt " + std::to_string(i));
+			}
+			catch (const std::exception& e)
+			{
+				log("Failed to " + name + " for job " + job + " in attempt " + std::to_string(i) + ": " + e.what());
+			}
+			if (i == max_attempts) return false;
+			std::this_thread::sleep_for(delay);
+			delay *= 2;
+		}
+	}
+
+	const std::function<void(const std::string&)> log; //!< Logger of failures.
+	const size_t max_attempts; //!< Maximum number of attempts per step.
+	const std::chrono::milliseconds initial_delay; //!< Delay before the second attempt of a step.
+	mutable std::mutex m;
+	std::condition_variable cv;
+	//! Represents a queued job.
+	struct job_steps
+	{
+		std::string name;
+		std::vector<std::pair<std::string, step>> steps;
+		std::vector<std::pair<std::string, final_step>> final_steps;
+	};
+
+	std::deque<job_steps> jobs; //!< Queued jobs, the front of which is being finalized.
+	bool stopping; //!< True once the destructor has been called.
+	std::thread worker; //!< Finalizer thread.
+};
+
+#endif
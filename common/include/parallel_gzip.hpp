@@ -0,0 +1,99 @@
+#pragma once
+#ifndef PARALLEL_GZIP_HPP
+#define PARALLEL_GZIP_HPP
+
+#include <deque>
+#include <algorithm>
+#include <future>
+#include <thread>
+#include <memory>
+#include <string>
+#include <ostream>
+#include <iterator>
+#include <boost/iostreams/categories.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+
+//! Represents a boost::iostreams sink that splits its input into blocks, compresses the blocks concurrently as independent gzip members, and writes the members in order to an underlying stream.
+//! A concatenation of gzip members is itself a valid gzip stream per RFC 1952, which gunzip and browsers decompress as a whole.
+class parallel_gzip_sink
+{
+public:
+	typedef char char_type;
+	struct category : boost::iostreams::sink_tag, boost::iostreams::closable_tag {};
+
+	//! Constructs a sink writing to os, which must outlive the sink. At most max_pending blocks are compressed at the same time.
+	explicit parallel_gzip_sink(std::ostream& os, const size_t block_size = 1 << 22, const size_t max_pending = std::thread::hardware_concurrency() << 1) : p(std::make_shared<state>(os, block_size, max_pending))
+	{
+	}
+
+	//! Appends n characters to the current block, and hands over the block to a compression task once it is full.
+	std::streamsize write(const char* s, const std::streamsize n)
+	{
+		for (std::streamsize i = 0; i < n;)
+		{
+			const std::streamsize m = std::min<std::streamsize>(n - i, p->block_size - p->block.size());
+			p->block.append(s + i, m);
+			i += m;
+			if (p->block.size() == p->block_size) p->dispatch();
+		}
+		return n;
+	}
+
+	//! Compresses the last partial block, and writes all the pending members in order.
+	void close()
+	{
+		if (!p->block.empty() || !p->num_blocks) p->dispatch(); // An empty input still yields one gzip member, just like gzip_compressor.
+		while (!p->pending.empty()) p->drain();
+		p->os.flush();
+	}
+
+private:
+	//! Represents the state shared by the copies of a sink, as boost::iostreams copies devices when pushing them onto a chain.
+	struct state
+	{
+		explicit state(std::ostream& os, const size_t block_size, const size_t max_pending) : os(os), block_size(block_size), max_pending(max_pending ? max_pending : 1), num_blocks(0)
+		{
+			block.reserve(block_size);
+		}
+
+		//! Compresses a block in a new task, after writing the oldest member if too many are pending.
+		void dispatch()
+		{
+			if (pending.size() == max_pending) drain();
+			pending.push_back(std::async(std::launch::async, [](const std::string b)
+			{
+				std::string member;
+				{
+					boost::iostreams::filtering_ostream fos;
+					fos.push(boost::iostreams::gzip_compressor());
+					fos.push(std::back_inserter(member));
+					fos.write(b.data(), b.size());
+				}
+				return member;
+			}, std::move(block)));
+			block.clear();
+			block.reserve(block_size);
+			++num_blocks;
+		}
+
+		//! Waits for the oldest pending member and writes it.
+		void drain()
+		{
+			const std::string member = pending.front().get();
+			pending.pop_front();
+			os.write(member.data(), member.size());
+		}
+
+		std::ostream& os; //!< Underlying stream of compressed output.
+		const size_t block_size; //!< Number of uncompressed bytes per gzip member.
+		const size_t max_pending; //!< Maximum number of blocks being compressed concurrently.
+		size_t num_blocks; //!< Number of blocks dispatched so far.
+		std::string block; //!< Current uncompressed block.
+		std::deque<std::future<std::string>> pending; //!< Members being compressed, in output order.
+	};
+
+	std::shared_ptr<state> p;
+};
+
+#endif
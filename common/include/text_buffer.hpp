@@ -0,0 +1,151 @@
+#pragma once
+#ifndef TEXT_BUFFER_HPP
+#define TEXT_BUFFER_HPP
+
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <ostream>
+#include <algorithm>
+#include <boost/assert.hpp>
+#include <boost/utility/string_ref.hpp>
+
+//! Represents a reusable character buffer into which strings, integers and fixed-point numbers are formatted in place.
+//! Numbers are formatted without iostream sentries, locale facets or temporary strings, and are byte-identical to std::fixed with std::setprecision and std::setw.
+class text_buffer
+{
+public:
+	//! Constructs a buffer with the given initial capacity in bytes.
+	explicit text_buffer(const size_t capacity = 1 << 12) : buf(capacity), n(0)
+	{
+	}
+
+	//! Returns a pointer to the formatted characters.
+	const char* data() const
+	{
+		return buf.data();
+	}
+
+	//! Returns the number of formatted characters.
+	size_t size() const
+	{
+		return n;
+	}
+
+	//! Returns true if no characters have been formatted since the last clear.
+	bool empty() const
+	{
+		return !n;
+	}
+
+	//! Discards the formatted characters while keeping the capacity for reuse.
+	void clear()
+	{
+		n = 0;
+	}
+
+	//! Writes the formatted characters to a stream and clears the buffer.
+	void flush(std::ostream& os)
+	{
+		os.write(buf.data(), n);
+		n = 0;
+	}
+
+	//! Appends a character.
+	text_buffer& put(const char c)
+	{
+		reserve(1)[0] = c;
+		++n;
+		return *this;
+	}
+
+	//! Appends a string.
+	text_buffer& put(const boost::string_ref s)
+	{
+		memcpy(reserve(s.size()), s.data(), s.size());
+		n += s.size();
+		return *this;
+	}
+
+	//! Appends an integer, right-aligned with spaces to at least the given width.
+	text_buffer& put_int(const long long v, const size_t width = 0)
+	{
+		char tmp[24];
+		char* const end = tmp + sizeof(tmp);
+		char* p = format_uint(end, v < 0 ? 0ULL - static_cast<unsigned long long>(v) : static_cast<unsigned long long>(v), 1);
+		if (v < 0) *--p = '-';
+		return pad(p, end - p, width);
+	}
+
+	//! Appends a floating point number in fixed notation with the given number of decimal places, right-aligned with spaces to at least the given width.
+	text_buffer& put_fixed(const double v, const size_t precision, const size_t width = 0)
+	{
+		static const double scales[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10 }; // Powers of ten by number of decimal places.
+		BOOST_ASSERT(precision < sizeof(scales) / sizeof(scales[0]));
+		char tmp[32];
+		char* const end = tmp + sizeof(tmp);
+
+		// Scale the magnitude so that the digits to keep form an integer, and round the remainder to nearest.
+		// The scaling may err by half an ulp, so remainders too close to one half, as well as huge and non-finite values, are left to snprintf() for correct rounding.
+		const double a = fabs(v) * scales[precision];
+		double i;
+		const double r = modf(a, &i) - 0.5;
+		if (!(a < 1e15) || fabs(r) <= a * 1e-15)
+		{
+			const int m = snprintf(nullptr, 0, "%.*f", static_cast<int>(precision), v);
+			std::vector<char> big(m + 1);
+			snprintf(big.data(), big.size(), "%.*f", static_cast<int>(precision), v);
+			return pad(big.data(), m, width);
+		}
+		char* p = format_uint(end, static_cast<unsigned long long>(i) + (r > 0), precision + 1);
+		if (precision)
+		{
+			// Shift the integer digits left by one to make room for the decimal point.
+			char* const dot = end - precision;
+			std::copy(p, dot, p - 1);
+			*(dot - 1) = '.';
+			--p;
+		}
+		if (std::signbit(v)) *--p = '-';
+		return pad(p, end - p, width);
+	}
+
+private:
+	//! Ensures room for k more characters, and returns a pointer to the first of them.
+	char* reserve(const size_t k)
+	{
+		if (n + k > buf.size()) buf.resize(std::max(buf.size() << 1, n + k));
+		return buf.data() + n;
+	}
+
+	//! Appends m characters, preceded by spaces to reach the given width.
+	text_buffer& pad(const char* s, const size_t m, const size_t width)
+	{
+		const size_t w = std::max(m, width);
+		char* const p = reserve(w);
+		memset(p, ' ', w - m);
+		memcpy(p + w - m, s, m);
+		n += w;
+		return *this;
+	}
+
+	//! Writes the decimal digits of u, at least min_digits of them with leading zeros, backwards from end. Returns a pointer to the first digit.
+	static char* format_uint(char* end, unsigned long long u, const size_t min_digits)
+	{
+		char* p = end;
+		do
+		{
+			*--p = '0' + u % 10;
+			u /= 10;
+		} while (u);
+		while (static_cast<size_t>(end - p) < min_digits) *--p = '0';
+		return p;
+	}
+
+	std::vector<char> buf; //!< Storage of formatted characters, which only grows.
+	size_t n; //!< Number of formatted characters.
+};
+
+#endif
@@ -0,0 +1,306 @@
+#pragma once
+#ifndef TRANSPORT_HPP
+#define TRANSPORT_HPP
+
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <memory>
+#include <thread>
+#include <stdexcept>
+#include <ostream>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/iostreams/categories.hpp>
+#include <curl/curl.h>
+
+//! Represents a source of job input files and a destination of job output files, both addressed by location strings.
+class transport
+{
+public:
+	//! Pulls up to n bytes of a file being put into a buffer, and returns the number of bytes pulled, or 0 at the end of the file.
+	typedef std::function<size_t(char*, size_t)> reader;
+
+	virtual ~transport() {}
+
+	//! Writes the file at a location into a stream. Returns false on failure.
+	virtual bool get(const std::string& location, std::ostream& os) = 0;
+
+	//! Writes a file of unknown length to a location, pulling its bytes from a reader until the reader is exhausted. Returns false on failure.
+	//! @exception runtime_error Thrown when the file cannot be staged locally, e.g. spooled to a full temporary directory.
+	virtual bool put(const std::string& location, const reader& read) = 0;
+};
+
+//! Represents a transport over the local filesystem, which stands in for a remote host when locations are plain paths, e.g. for testing.
+class directory_transport : public transport
+{
+public:
+	bool get(const std::string& location, std::ostream& os)
+	{
+		boost::filesystem::ifstream ifs(location, std::ios::binary);
+		if (!ifs) return false;
+		os << ifs.rdbuf();
+		return true;
+	}
+
+	//! Writes into a .part file first and renames it, so that a partially written file is never visible at the location.
+	bool put(const std::string& location, const reader& read)
+	{
+		const std::string part = location + ".part";
+		{
+			boost::filesystem::ofstream ofs(part, std::ios::binary);
+			char buf[1 << 16];
+			for (size_t n; (n = read(buf, sizeof(buf))) > 0;)
+			{
+				ofs.write(buf, n);
+			}
+			if (!ofs) return false;
+		}
+		boost::system::error_code ec;
+		boost::filesystem::rename(part, location, ec);
+		return !ec;
+	}
+};
+
+//! Represents a transport via libcurl with SSH public key authentication, e.g. to scp:// and sftp:// locations.
+//! SCP requires the file size before the first byte is sent, so files put to scp:// locations are spooled to a temporary local file, while other protocols are streamed directly.
+class curl_transport : public transport
+{
+public:
+	//! Constructs a transport authenticating with the given key files. curl_global_init() must have been called.
+	explicit curl_transport(const std::string& private_keyfile, const std::string& public_keyfile) : private_keyfile(private_keyfile), public_keyfile(public_keyfile)
+	{
+	}
+
+	bool get(const std::string& location, std::ostream& os)
+	{
+		const auto curl = init(location);
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_to_ostream);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, &os);
+		const auto rc = curl_easy_perform(curl);
+		curl_easy_cleanup(curl);
+		return rc == CURLE_OK;
+	}
+
+	bool put(const std::string& location, const reader& read)
+	{
+		const auto curl = init(location);
+		curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+		CURLcode rc;
+		if (location.compare(0, 6, "scp://"))
+		{
+			curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_from_reader);
+			curl_easy_setopt(curl, CURLOPT_READDATA, &read);
+			rc = curl_easy_perform(curl);
+		}
+		else
+		{
+			const auto spool_path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+			const auto spool = fopen(spool_path.c_str(), "w+b");
+			if (!spool)
+			{
+				curl_easy_cleanup(curl);
+				return false;
+			}
+			try
+			{
+				char buf[1 << 16];
+				for (size_t n; (n = read(buf, sizeof(buf))) > 0;)
+				{
+					if (fwrite(buf, 1, n, spool) != n) throw std::runtime_error("Failed to write the spool file " + spool_path.string());
+				}
+				if (fflush(spool)) throw std::runtime_error("Failed to flush the spool file " + spool_path.string());
+				const auto size = ftell(spool);
+				if (size < 0) throw std::runtime_error("Failed to determine the size of the spool file " + spool_path.string());
+				curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, static_cast<curl_off_t>(size));
+			}
+			catch (...)
+			{
+				// Upload nothing rather than a truncated file.
+				fclose(spool);
+				boost::system::error_code ec;
+				boost::filesystem::remove(spool_path, ec);
+				curl_easy_cleanup(curl);
+				throw;
+			}
+			rewind(spool);
+			curl_easy_setopt(curl, CURLOPT_READDATA, spool); // The default read function calls fread().
+			rc = curl_easy_perform(curl);
+			fclose(spool);
+			boost::filesystem::remove(spool_path);
+		}
+		curl_easy_cleanup(curl);
+		return rc == CURLE_OK;
+	}
+
+private:
+	//! Creates a curl handle for a location.
+	CURL* init(const std::string& location) const
+	{
+		const auto curl = curl_easy_init();
+		curl_easy_setopt(curl, CURLOPT_SSH_AUTH_TYPES, CURLSSH_AUTH_PUBLICKEY);
+		curl_easy_setopt(curl, CURLOPT_SSH_PRIVATE_KEYFILE, private_keyfile.c_str());
+		curl_easy_setopt(curl, CURLOPT_SSH_PUBLIC_KEYFILE, public_keyfile.c_str());
+		curl_easy_setopt(curl, CURLOPT_URL, location.c_str());
+		return curl;
+	}
+
+	static size_t write_to_ostream(const char* buffer, const size_t size, const size_t count, std::ostream* os)
+	{
+		os->write(buffer, size * count);
+		return size * count;
+	}
+
+	static size_t read_from_reader(char* buffer, const size_t size, const size_t count, const reader* read)
+	{
+		return (*read)(buffer, size * count);
+	}
+
+	const std::string private_keyfile;
+	const std::string public_keyfile;
+};
+
+//! Creates a curl transport if the jobs path is a URL, or otherwise a directory transport.
+inline std::unique_ptr<transport> make_transport(const std::string& jobs_path, const std::string& private_keyfile, const std::string& public_keyfile)
+{
+	if (jobs_path.find("://") == std::string::npos) return std::unique_ptr<transport>(new directory_transport);
+	return std::unique_ptr<transport>(new curl_transport(private_keyfile, public_keyfile));
+}
+
+//! Represents a boost::iostreams sink whose bytes are put to a location by a transfer thread while they are being written.
+//! Writers block once capacity bytes are buffered but not yet transferred, so that memory stays bounded and the transfer overlaps with the production of the bytes.
+class upload_sink
+{
+public:
+	typedef char char_type;
+	struct category : boost::iostreams::sink_tag, boost::iostreams::closable_tag {};
+
+	//! Starts transferring to a location via a transport, which must outlive the transfer.
+	explicit upload_sink(transport& t, const std::string& location, const size_t capacity = 1 << 22) : p(std::make_shared<state>(capacity))
+	{
+		const auto q = p.get();
+		p->transfer = std::thread([&t, location, q]()
+		{
+			bool ok;
+			try
+			{
+				ok = t.put(location, [q](char* buf, const size_t n)
+				{
+					return q->read(buf, n);
+				});
+			}
+			catch (const std::exception& e)
+			{
+				// Report the exception as a failed transfer, which the caller may retry.
+				ok = false;
+				std::lock_guard<std::mutex> guard(q->m);
+				q->error = e.what();
+			}
+			std::lock_guard<std::mutex> guard(q->m);
+			q->succeeded = ok;
+			q->finished = true;
+			q->cv.notify_all();
+		});
+	}
+
+	//! Appends n bytes to the buffer, waiting for room if necessary. Bytes are discarded once the transfer has ended prematurely.
+	std::streamsize write(const char* s, const std::streamsize n)
+	{
+		std::unique_lock<std::mutex> lock(p->m);
+		p->cv.wait(lock, [this]() { return p->num_bytes < p->capacity || p->finished; });
+		if (!p->finished)
+		{
+			p->chunks.emplace_back(s, n);
+			p->num_bytes += n;
+			p->cv.notify_all();
+		}
+		return n;
+	}
+
+	//! Signals the end of the file, and waits for the transfer to complete.
+	void close()
+	{
+		p->close();
+	}
+
+	//! Returns true if the transfer has completed successfully. Valid after close().
+	bool succeeded() const
+	{
+		return p->succeeded;
+	}
+
+	//! Returns the message of the exception that failed the transfer, or an empty string. Valid after close().
+	const std::string& error() const
+	{
+		return p->error;
+	}
+
+private:
+	//! Represents the state shared by the copies of a sink, as boost::iostreams copies devices.
+	struct state
+	{
+		explicit state(const size_t capacity) : capacity(capacity), num_bytes(0), offset(0), closed(false), finished(false), succeeded(false)
+		{
+		}
+
+		~state()
+		{
+			close();
+		}
+
+		//! Pulls up to n buffered bytes for the transfer thread, waiting for more if necessary. Returns 0 at the end of the file.
+		size_t read(char* buf, const size_t n)
+		{
+			std::unique_lock<std::mutex> lock(m);
+			cv.wait(lock, [this]() { return !chunks.empty() || closed; });
+			size_t r = 0;
+			while (r < n && !chunks.empty())
+			{
+				const std::string& c = chunks.front();
+				const size_t k = std::min(n - r, c.size() - offset);
+				memcpy(buf + r, c.data() + offset, k);
+				r += k;
+				offset += k;
+				if (offset == c.size())
+				{
+					chunks.pop_front();
+					offset = 0;
+				}
+			}
+			num_bytes -= r;
+			cv.notify_all();
+			return r;
+		}
+
+		void close()
+		{
+			{
+				std::lock_guard<std::mutex> guard(m);
+				closed = true;
+				cv.notify_all();
+			}
+			if (transfer.joinable()) transfer.join();
+		}
+
+		std::mutex m;
+		std::condition_variable cv;
+		std::deque<std::string> chunks; //!< Buffered bytes not yet transferred.
+		const size_t capacity; //!< Number of buffered bytes above which writers wait.
+		size_t num_bytes; //!< Number of buffered bytes, less those already transferred from the front chunk.
+		size_t offset; //!< Number of bytes already transferred from the front chunk.
+		bool closed; //!< True once the end of the file has been signaled.
+		bool finished; //!< True once the transfer thread has returned.
+		bool succeeded; //!< True if the transport succeeded.
+		std::string error; //!< Message of the exception thrown by the transport, if any.
+		std::thread transfer; //!< Transfer thread.
+	};
+
+	std::shared_ptr<state> p;
+};
+
+#endif
@@ -0,0 +1,24 @@
+#!/usr/bin/env node
+
+// Writes the exclusive ending offsets of the lines of a text file, e.g. 16_zincid.txt, to a footer file, e.g. 16_zincid.ftr, as 64-bit little-endian integers.
+// Offsets are counted from the bytes read, so that a line ends after its newline whatever its line terminator, and a last line without a trailing newline ends at the end of the file.
+var fs = require('fs');
+var txt = process.argv[2];
+var buf = new require('buffer').Buffer(8);
+var fd = fs.openSync(txt.substr(0, txt.lastIndexOf('.')) + '.ftr', 'w');
+var pos = 0, end = 0;
+var writeEnd = function(e) {
+	end = e;
+	buf.writeUInt32LE(end % 0x100000000, 0);
+	buf.writeUInt32LE(Math.floor(end / 0x100000000), 4);
+	fs.writeSync(fd, buf, 0, 8);
+};
+fs.createReadStream(txt).on('data', function(chunk) {
+	for (var i = chunk.indexOf(10); i !== -1; i = chunk.indexOf(10, i + 1)) {
+		writeEnd(pos + i + 1);
+	}
+	pos += chunk.length;
+}).on('end', function() {
+	if (pos > end) writeEnd(pos);
+	fs.closeSync(fd);
+});
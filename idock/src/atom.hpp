@@ -70,7 +70,7 @@ const string ad_type_strings[] = ///< AutoDock4 atom type names.
 };
 
 /// Parses AutoDock4 atom type name, and returns AD_TYPE_SIZE if it does not match any supported AutoDock4 atom types.
-inline size_t parse_ad_type_string(const string& ad_type_string)
+inline size_t parse_ad_type_string(const string_ref ad_type_string)
 {
 	for (size_t i = 0; i < AD_TYPE_SIZE; ++i)
 	{
@@ -79,6 +79,13 @@ inline size_t parse_ad_type_string(const string& ad_type_string)
 	return AD_TYPE_SIZE;
 }
 
+/// Returns the AutoDock4 atom type name located at 1-based [78, 79] of an ATOM/HETATM line in pdbqt format, which is one or two characters wide.
+inline string_ref ad_type_field(const string_ref line)
+{
+	const string_ref field = line.substr(77, 2);
+	return (field.size() == 2 && !isspace(field[1])) ? field : field.substr(0, 1);
+}
+
 // http://en.wikipedia.org/wiki/Atomic_radii_of_the_elements_(data_page)
 // http://en.wikipedia.org/wiki/Covalent_radius
 // The above two references have inconsistent values for covalent radius.
@@ -304,14 +311,13 @@ const fl hbond_dist_sqr = sqr(3.5);
 class atom
 {
 public:
-	string name; ///< Atom name;
 	vec3 coordinate; ///< 3D coordinate.
 	size_t ad; ///< AutoDock4 atom type.
 	size_t xs; ///< XScore atom type.
 	size_t rf; ///< RF-Score atom type.
 
 	/// Constructs an atom with 3D coordinate and AutoDock4 atom type.
-	explicit atom(string&& name_, const vec3& coordinate, const size_t ad) : name(static_cast<string&&>(name_)), coordinate(coordinate), ad(ad), xs(ad_to_xs[ad]), rf(ad_to_rf[ad]) {}
+	explicit atom(const vec3& coordinate, const size_t ad) : coordinate(coordinate), ad(ad), xs(ad_to_xs[ad]), rf(ad_to_rf[ad]) {}
 
 	/// Returns the covalent radius of current AutoDock4 atom type.
 	fl covalent_radius() const
@@ -28,6 +28,11 @@ box::box(const vec3& center, const vec3& size, const fl grid_granularity) : cent
 	}
 }
 
+size_t box::grid_map_bytes() const
+{
+	return sizeof(fl) * num_probes[0] * num_probes[1] * num_probes[2];
+}
+
 bool box::within(const vec3& coordinate) const
 {
 	for (size_t i = 0; i < 3; ++i) // The loop may be unrolled by enabling compiler optimization.
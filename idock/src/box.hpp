@@ -34,6 +34,9 @@ public:
 	/// @param grid_granularity 1D size of grids.
 	box(const vec3& center, const vec3& size, const fl grid_granularity);
 
+	/// Returns the number of bytes of the grid map of an XScore atom type.
+	size_t grid_map_bytes() const;
+
 	/// Returns true if a coordinate is within current half-open-half-close box, i.e. [corner1, corner2).
 	bool within(const vec3& coordinate) const;
 
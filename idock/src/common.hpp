@@ -2,9 +2,11 @@
 #ifndef IDOCK_COMMON_HPP
 #define IDOCK_COMMON_HPP
 
+#include <cstdint>
 #include <vector>
 #include <string>
 #include <boost/lexical_cast.hpp>
+#include <boost/utility/string_ref.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/random.hpp>
 #include <boost/assert.hpp>
@@ -13,6 +15,7 @@
 using std::vector;
 using std::string;
 using boost::lexical_cast;
+using boost::string_ref;
 using boost::filesystem::path;
 
 /// Use single precision floating point due to the fact that only 4GB RAM is installed on Mac workstations.
@@ -41,25 +44,110 @@ inline T sqr(const T x)
 	return x * x;
 }
 
-/// Returns true if a string starts with another string.
-inline bool starts_with(const string& str, const string& start)
+/// Returns a 64-bit hash of a 64-bit value by the SplitMix64 finalizer, whose output bits are uniformly distributed even for consecutive inputs.
+inline uint64_t mix64(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+/// Returns a 64-bit hash of a string by FNV-1a followed by mix64.
+inline uint64_t hash64(const char* s, const size_t n)
 {
-	const size_t start_size = start.size();
-	if (str.size() < start_size) return false;
-	for (size_t i = 0; i < start_size; ++i)
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < n; ++i)
 	{
-		if (str[i] != start[i]) return false;
+		h = (h ^ static_cast<unsigned char>(s[i])) * 0x100000001b3ULL;
 	}
+	return mix64(h);
+}
+
+/// Returns true if an item is kept by sampling with a given probability. The decision depends only on the key and the item index, not on the order or the grouping in which items are visited.
+inline bool sampled(const uint64_t key, const size_t index, const double probability)
+{
+	return (mix64(key ^ mix64(index)) >> 11) * (1.0 / (1ULL << 53)) < probability;
+}
+
+/// Returns true if a string starts with another string.
+inline bool starts_with(const string_ref str, const string_ref start)
+{
+	return str.starts_with(start);
+}
+
+/// Extracts the next line from a buffer without copying, and advances the buffer past the line and its newline.
+/// Returns false if the buffer has been exhausted.
+inline bool getline(string_ref& buf, string_ref& line)
+{
+	if (buf.empty()) return false;
+	const size_t eol = buf.find('\n');
+	line = buf.substr(0, eol);
+	buf.remove_prefix(eol == string_ref::npos ? buf.size() : eol + 1);
 	return true;
 }
 
+/// Returns 1-based [i, j] of str with leading spaces removed.
+inline string_ref right_field(const string_ref str, const size_t i, const size_t j)
+{
+	string_ref field = str.substr(i - 1, j - i + 1);
+	while (!field.empty() && field.front() == ' ') field.remove_prefix(1);
+	return field;
+}
+
 /// Parses right-justified 1-based [i, j] of str into generic type T lexically.
 /// This conversion does not apply to left-justified values.
 template<typename T>
-inline T right_cast(const string& str, const size_t i, const size_t j)
+inline T right_cast(const string_ref str, const size_t i, const size_t j)
 {
-	const size_t start = str.find_first_not_of(' ', i - 1);
-	return lexical_cast<T>(str.substr(start, j - start));
+	const string_ref field = right_field(str, i, j);
+	return lexical_cast<T>(field.data(), field.size());
+}
+
+/// Parses right-justified 1-based [i, j] of str into an unsigned integer without allocation.
+template<>
+inline size_t right_cast<size_t>(const string_ref str, const size_t i, const size_t j)
+{
+	const string_ref field = right_field(str, i, j);
+	size_t v = 0;
+	for (const char c : field)
+	{
+		if (c < '0' || c > '9') return lexical_cast<size_t>(field.data(), field.size()); // Throws bad_lexical_cast.
+		v = v * 10 + (c - '0');
+	}
+	if (field.empty()) return lexical_cast<size_t>(field.data(), field.size()); // Throws bad_lexical_cast.
+	return v;
+}
+
+/// Parses right-justified 1-based [i, j] of str into a floating point value in fixed-point notation, e.g. a PDBQT coordinate of %8.3f, without allocation.
+/// Both the integral mantissa and the power of ten are exact, so their quotient is correctly rounded just like lexical_cast. Other notations fall back to lexical_cast.
+template<>
+inline fl right_cast<fl>(const string_ref str, const size_t i, const size_t j)
+{
+	static const fl pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15 };
+	const string_ref field = right_field(str, i, j);
+	size_t k = 0;
+	const bool negative = k < field.size() && field[k] == '-';
+	if (negative || (k < field.size() && field[k] == '+')) ++k;
+	uint64_t mantissa = 0;
+	size_t num_digits = 0, num_decimals = 0;
+	bool point = false;
+	for (; k < field.size(); ++k)
+	{
+		const char c = field[k];
+		if (c == '.' && !point)
+		{
+			point = true;
+			continue;
+		}
+		if (c < '0' || c > '9' || num_digits == 15) return lexical_cast<fl>(field.data(), field.size());
+		mantissa = mantissa * 10 + (c - '0');
+		++num_digits;
+		num_decimals += point;
+	}
+	if (!num_digits) return lexical_cast<fl>(field.data(), field.size()); // Throws bad_lexical_cast.
+	const fl v = mantissa / pow10[num_decimals];
+	return negative ? -v : v;
 }
 
 #endif
@@ -0,0 +1,111 @@
+#include <cmath>
+#include <algorithm>
+#include "cost_model.hpp"
+
+/// Prior ratio of interacting pairs to squared heavy atoms, used to estimate the interacting pairs of a ligand before it is loaded.
+static const double prior_pairs_per_sqr_heavy_atom = 0.25;
+
+cost_model::cost_model() : num_records(0), total_seconds(0), total_evaluations(0), sum_pairs(0), sum_sqr_heavy_atoms(0)
+{
+	// Roughly 64 chains of 100 * h iterations of about 30 evaluations each, at tens of nanoseconds per term, spread across threads.
+	priors[0] = 0;
+	priors[1] = 2e-4;
+	priors[2] = 5e-4;
+	priors[3] = 2e-4;
+	coefficients = priors;
+	xtx.fill(0);
+	xty.fill(0);
+}
+
+array<double, cost_model::num_terms> cost_model::regressors(const size_t num_heavy_atoms, const size_t num_active_torsions, const size_t num_interacting_pairs)
+{
+	const double h = static_cast<double>(num_heavy_atoms);
+	const array<double, num_terms> x = {{ h, h * h, h * num_active_torsions, h * num_interacting_pairs }};
+	return x;
+}
+
+double cost_model::predict(const size_t num_heavy_atoms, const size_t num_active_torsions, const size_t num_interacting_pairs) const
+{
+	const auto x = regressors(num_heavy_atoms, num_active_torsions, num_interacting_pairs);
+	double seconds = 0;
+	for (size_t i = 0; i < num_terms; ++i)
+	{
+		seconds += coefficients[i] * x[i];
+	}
+	return max(seconds, 0.0);
+}
+
+double cost_model::predict(const library& lib, const size_t index) const
+{
+	const size_t h = max<int16_t>(lib.xproperties[index].counts[14], 0);
+	const size_t t = max<int16_t>(lib.zproperties[index].nrb, 0);
+	const double pairs_per_sqr_heavy_atom = sum_sqr_heavy_atoms > 0 ? sum_pairs / sum_sqr_heavy_atoms : prior_pairs_per_sqr_heavy_atom;
+	return predict(h, t, static_cast<size_t>(pairs_per_sqr_heavy_atom * h * h));
+}
+
+void cost_model::record(const size_t num_heavy_atoms, const size_t num_active_torsions, const size_t num_interacting_pairs, const double seconds, const size_t num_evaluations)
+{
+	++num_records;
+	total_seconds += seconds;
+	total_evaluations += num_evaluations;
+	sum_pairs += num_interacting_pairs;
+	sum_sqr_heavy_atoms += static_cast<double>(num_heavy_atoms) * num_heavy_atoms;
+
+	// Accumulate the normal equations.
+	const auto x = regressors(num_heavy_atoms, num_active_torsions, num_interacting_pairs);
+	for (size_t i = 0; i < num_terms; ++i)
+	{
+		for (size_t j = 0; j < num_terms; ++j)
+		{
+			xtx[num_terms * i + j] += x[i] * x[j];
+		}
+		xty[i] += x[i] * seconds;
+	}
+
+	// Solve (X'X + l * D) b = X'y + l * D * priors by Gaussian elimination with partial pivoting, where D is the diagonal of X'X, so that coefficients poorly determined by the records stay near their priors.
+	const double l = 1e-3;
+	array<double, num_terms * num_terms> a;
+	array<double, num_terms> b;
+	for (size_t i = 0; i < num_terms; ++i)
+	{
+		for (size_t j = 0; j < num_terms; ++j)
+		{
+			a[num_terms * i + j] = xtx[num_terms * i + j];
+		}
+		const double d = l * xtx[num_terms * i + i] + 1e-12;
+		a[num_terms * i + i] += d;
+		b[i] = xty[i] + d * priors[i];
+	}
+	for (size_t k = 0; k < num_terms; ++k)
+	{
+		size_t p = k;
+		for (size_t i = k + 1; i < num_terms; ++i)
+		{
+			if (fabs(a[num_terms * i + k]) > fabs(a[num_terms * p + k])) p = i;
+		}
+		if (a[num_terms * p + k] == 0) return;
+		for (size_t j = 0; j < num_terms; ++j)
+		{
+			swap(a[num_terms * k + j], a[num_terms * p + j]);
+		}
+		swap(b[k], b[p]);
+		for (size_t i = k + 1; i < num_terms; ++i)
+		{
+			const double m = a[num_terms * i + k] / a[num_terms * k + k];
+			for (size_t j = k; j < num_terms; ++j)
+			{
+				a[num_terms * i + j] -= m * a[num_terms * k + j];
+			}
+			b[i] -= m * b[k];
+		}
+	}
+	for (size_t k = num_terms; k--;)
+	{
+		double s = b[k];
+		for (size_t j = k + 1; j < num_terms; ++j)
+		{
+			s -= a[num_terms * k + j] * coefficients[j];
+		}
+		coefficients[k] = s / a[num_terms * k + k];
+	}
+}
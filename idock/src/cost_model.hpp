@@ -0,0 +1,45 @@
+#pragma once
+#ifndef IDOCK_COST_MODEL_HPP
+#define IDOCK_COST_MODEL_HPP
+
+#include <array>
+#include "library.hpp"
+using namespace std;
+
+/// Represents a model of the wall time of docking a ligand, i.e. h * (b0 + b1 * h + b2 * t + b3 * p) seconds for h heavy atoms, t active torsions and p intra-ligand interacting pairs.
+/// The Monte Carlo iterations scale with h, and each of their evaluations scales with the inter-molecular terms of h atoms, the torsions to optimize and the intra-molecular terms of p pairs.
+/// A default constructed model holds prior coefficients, whose relative magnitudes suffice for ordering and partitioning work. Recording observed costs refits the coefficients by ridge regression towards the prior.
+class cost_model
+{
+public:
+	static const size_t num_terms = 4; ///< Number of coefficients.
+
+	/// Constructs a model with prior coefficients.
+	cost_model();
+
+	/// Returns the predicted seconds to dock a ligand.
+	double predict(const size_t num_heavy_atoms, const size_t num_active_torsions, const size_t num_interacting_pairs) const;
+
+	/// Returns the predicted seconds to dock a ligand of a library before it is loaded, estimating its active torsions by its rotatable bonds and its interacting pairs by its heavy atoms.
+	double predict(const library& lib, const size_t index) const;
+
+	/// Records the observed cost of docking a ligand, and refits the coefficients.
+	void record(const size_t num_heavy_atoms, const size_t num_active_torsions, const size_t num_interacting_pairs, const double seconds, const size_t num_evaluations);
+
+	size_t num_records; ///< Number of recorded ligands.
+	double total_seconds; ///< Total wall time of the recorded ligands.
+	size_t total_evaluations; ///< Total number of evaluations of the recorded ligands.
+
+private:
+	/// Returns the regressors of a ligand.
+	static array<double, num_terms> regressors(const size_t num_heavy_atoms, const size_t num_active_torsions, const size_t num_interacting_pairs);
+
+	array<double, num_terms> coefficients; ///< Fitted coefficients.
+	array<double, num_terms> priors; ///< Prior coefficients.
+	array<double, num_terms * num_terms> xtx; ///< Accumulated products of regressors.
+	array<double, num_terms> xty; ///< Accumulated products of regressors and seconds.
+	double sum_pairs; ///< Total interacting pairs of the recorded ligands.
+	double sum_sqr_heavy_atoms; ///< Total squared heavy atoms of the recorded ligands.
+};
+
+#endif
@@ -0,0 +1,71 @@
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <unordered_set>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include "library.hpp"
+#include "ligand.hpp"
+
+using namespace std;
+using namespace boost::filesystem;
+
+int main(int argc, char* argv[])
+{
+	// Check the required number of command line arguments.
+	if (argc < 2)
+	{
+		cout << "dedup 16" << endl;
+		return 0;
+	}
+
+	// Remove previously computed keys so that they will not be mapped by the library constructor.
+	const string prefix = argv[1];
+	const path key_path = prefix + "_key.bin";
+	remove(key_path);
+
+	// Compute the structure key of every ligand of the library, i.e. the hash of its canonical SMILES and the sorted AutoDock types of the atoms that idock parses.
+	// Neither depends on the atom order or the coordinates of the pdbqt, so the same structure listed by several vendors gets the same key and needs to be docked only once.
+	// The atom types tell apart ligands whose pdbqt disagrees with their SMILES, e.g. in the polar hydrogens of their protonation state.
+	const library lib(prefix);
+	boost::filesystem::ofstream keys(key_path, ios::binary);
+	unordered_set<uint64_t> unique_keys;
+	size_t num_failures = 0;
+	string text;
+	vector<string> ad_types;
+	for (size_t idx = 0; idx < lib.num_ligands; ++idx)
+	{
+		uint64_t key;
+		try
+		{
+			const auto smiles = lib.smileses[idx];
+			if (smiles.empty()) throw runtime_error("Empty SMILES");
+			if (lib.records.is_open() && lib.records[idx].empty()) throw runtime_error("Empty precompiled record");
+			const ligand lig = lib.records.is_open() ? ligand(lib.records[idx].data()) : ligand(lib.pdbqt(idx));
+			ad_types.clear();
+			lig.for_each_line([&](const string_ref line)
+			{
+				if (line.starts_with("ATOM") || line.starts_with("HETATM")) ad_types.push_back(ad_type_field(line).to_string());
+			});
+			sort(ad_types.begin(), ad_types.end());
+			text.assign(smiles.data(), smiles.size());
+			for (const auto& t : ad_types)
+			{
+				text.push_back(' ');
+				text.append(t);
+			}
+			key = hash64(text.data(), text.size());
+		}
+		catch (const exception& e)
+		{
+			// Key the ligand by its entire text, which includes its ZINC ID, so that it is never merged with another ligand.
+			cerr << "Ligand " << idx << ": " << e.what() << endl;
+			++num_failures;
+			const auto pdbqt = lib.pdbqt(idx);
+			key = hash64(pdbqt.data(), pdbqt.size());
+		}
+		keys.write(reinterpret_cast<const char*>(&key), sizeof(key));
+		unique_keys.insert(key);
+	}
+	cout << "Computed the keys of " << lib.num_ligands << " ligands, of which " << unique_keys.size() << " are unique, i.e. a duplicate rate of " << (lib.num_ligands ? 100.0 * (lib.num_ligands - unique_keys.size()) / lib.num_ligands : 0) << "%, and " << num_failures << " failed to parse" << endl;
+}
@@ -0,0 +1,89 @@
+#include <iostream>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include "library.hpp"
+#include "ligand.hpp"
+#include "property_index.hpp"
+#include "cost_model.hpp"
+
+using namespace std;
+using namespace boost::filesystem;
+
+int main(int argc, char* argv[])
+{
+	// Check the required number of command line arguments.
+	if (argc < 2)
+	{
+		cout << "encode 16" << endl;
+		return 0;
+	}
+
+	// Remove a previously encoded library so that it will not be mapped by the library constructor.
+	const string prefix = argv[1];
+	const path bin_path = prefix + "_ligand.bin";
+	const path ftr_path = prefix + "_ligand.ftr";
+	remove(bin_path);
+	remove(ftr_path);
+
+	// Parse every ligand of the library, and write its precompiled record and the ending offset of the record.
+	const library lib(prefix);
+	boost::filesystem::ofstream bin(bin_path, ios::binary);
+	boost::filesystem::ofstream ftr(ftr_path, ios::binary);
+	size_t num_failures = 0;
+	for (size_t idx = 0; idx < lib.num_ligands; ++idx)
+	{
+		try
+		{
+			ligand(lib.pdbqt(idx)).encode(bin);
+		}
+		catch (const exception& e)
+		{
+			// Write an empty record, which idock skips, to keep the records aligned with the library indexes.
+			cerr << "Ligand " << idx << ": " << e.what() << endl;
+			++num_failures;
+		}
+
+		// Pad the record to a multiple of 8 bytes.
+		while (bin.tellp() & 7) bin.put(0);
+		const size_t end = bin.tellp();
+		ftr.write(reinterpret_cast<const char*>(&end), sizeof(end));
+	}
+	cout << "Encoded " << lib.num_ligands - num_failures << " ligands and left " << num_failures << " empty records for ligands that failed to parse" << endl;
+
+	// Transpose ligand properties into the columns and zone maps of the property index, which idock maps for fast range filtering.
+	property_index::write(lib, prefix);
+	cout << "Wrote the property index of " << lib.num_ligands << " ligands" << endl;
+
+	// Calculate the slice split points, so that slices have equal predicted docking costs rather than equal numbers of ligands.
+	// The prior cost model is used, so that the split points depend on the library only.
+	const size_t num_slices = 10;
+	const cost_model prior_costs;
+	double total_cost = 0;
+	for (size_t i = 0; i < lib.num_ligands; ++i)
+	{
+		total_cost += prior_costs.predict(lib, i);
+	}
+	vector<size_t> splits;
+	double cost = 0;
+	for (size_t i = 0; i < lib.num_ligands && splits.size() + 1 < num_slices; ++i)
+	{
+		cost += prior_costs.predict(lib, i);
+		while (splits.size() + 1 < num_slices && cost >= total_cost * (splits.size() + 1) / num_slices) splits.push_back(i + 1);
+	}
+	while (splits.size() + 1 < num_slices) splits.push_back(lib.num_ligands);
+
+	// Record the split points in the manifest, replacing those of a previous encoding, so that idock need not predict the costs of all the ligands at startup.
+	const path manifest_path = prefix + "_manifest.conf";
+	vector<string> lines;
+	{
+		boost::filesystem::ifstream ifs(manifest_path);
+		for (string line; getline(ifs, line);)
+		{
+			if (line.compare(0, 5, "split")) lines.push_back(line);
+		}
+	}
+	boost::filesystem::ofstream manifest(manifest_path);
+	for (const auto& line : lines) manifest << line << '\n';
+	for (const auto split : splits) manifest << "split = " << split << '\n';
+	cout << "Recorded " << splits.size() << " split points of " << num_slices << " slices of equal predicted docking cost in " << manifest_path.string() << endl;
+}
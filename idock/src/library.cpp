@@ -0,0 +1,99 @@
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <boost/program_options.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include "library.hpp"
+
+using std::runtime_error;
+
+void blob_array::open(const path& p)
+{
+	file.open(p);
+	ftr.open(path(p).replace_extension(".ftr"));
+}
+
+string_ref blob_array::operator[](const size_t index) const
+{
+	const size_t beg = index ? ftr[index - 1] : 0;
+	const size_t end = ftr[index];
+	BOOST_ASSERT(beg <= end);
+	BOOST_ASSERT(end <= file.size());
+	return string_ref(file.data() + beg, end - beg);
+}
+
+string_ref string_array::operator[](const size_t index) const
+{
+	string_ref s = blob_array::operator[](index);
+	if (!s.empty() && s.back() == '\n') s.remove_suffix(1);
+	if (!s.empty() && s.back() == '\r') s.remove_suffix(1);
+	return s;
+}
+
+string_ref library::pdbqt(const size_t index) const
+{
+	const size_t beg = headers[index];
+	const size_t end = index + 1 < num_ligands ? headers[index + 1] : pdbqts.size();
+	BOOST_ASSERT(beg <= end);
+	BOOST_ASSERT(end <= pdbqts.size());
+	return string_ref(pdbqts.data() + beg, end - beg);
+}
+
+void library::prefetch(const size_t index) const
+{
+	const string_ref s = records.is_open() ? records[index] : pdbqt(index);
+	if (s.empty()) return;
+
+	// posix_madvise() requires a page-aligned address.
+	static const size_t page_size = sysconf(_SC_PAGESIZE);
+	const size_t offset = reinterpret_cast<size_t>(s.data()) & (page_size - 1);
+	posix_madvise(const_cast<char*>(s.data() - offset), s.size() + offset, POSIX_MADV_WILLNEED);
+}
+
+library::library(const string& prefix)
+{
+	// Read the number of ligands from the manifest.
+	using namespace boost::program_options;
+	options_description manifest_options;
+	manifest_options.add_options()
+		("ligands", value<size_t>(&num_ligands)->required())
+		("split", value<vector<size_t>>(&splits))
+		;
+	boost::filesystem::ifstream manifest(prefix + "_manifest.conf");
+	if (!manifest) throw runtime_error("Library manifest " + prefix + "_manifest.conf is missing");
+	variables_map vm;
+	store(parse_config_file(manifest, manifest_options, true), vm);
+	vm.notify();
+	for (size_t s = 0; s < splits.size(); ++s)
+	{
+		if (splits[s] > num_ligands || (s && splits[s] < splits[s - 1])) throw runtime_error("Library manifest " + prefix + "_manifest.conf has split points out of order");
+	}
+
+	// Map the metadata files and check their sizes against the manifest.
+	zincids.open(prefix + "_zincid.txt");
+	smileses.open(prefix + "_smiles.txt");
+	suppliers.open(prefix + "_supplier.txt");
+	zproperties.open(prefix + "_zprop.bin", 26); // sizeof(zproperty) == 28
+	xproperties.open(prefix + "_xprop.bin");
+	headers.open(prefix + "_header.bin");
+	pdbqts.open(prefix + "_ligand.pdbqt");
+	if (boost::filesystem::exists(prefix + "_ligand.bin"))
+	{
+		records.open(prefix + "_ligand.bin");
+	}
+	if (boost::filesystem::exists(prefix + "_key.bin"))
+	{
+		keys.open(prefix + "_key.bin");
+	}
+	if (zincids.size() != num_ligands || smileses.size() != num_ligands || suppliers.size() != num_ligands || zproperties.size() != num_ligands || xproperties.size() != num_ligands || headers.size() != num_ligands || (records.is_open() && records.size() != num_ligands) || (keys.size() && keys.size() != num_ligands))
+	{
+		throw runtime_error("Library files of " + prefix + " are inconsistent with its manifest of " + lexical_cast<string>(num_ligands) + " ligands");
+	}
+
+	// Check the last ending offset of each footer once, as the per-record bounds check is compiled out by NDEBUG.
+	if (!zincids.is_within_file() || !smileses.is_within_file() || !suppliers.is_within_file() || (records.is_open() && !records.is_within_file()))
+	{
+		throw runtime_error("Footer files of " + prefix + " point past the end of their data files");
+	}
+}
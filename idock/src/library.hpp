@@ -0,0 +1,145 @@
+#pragma once
+#ifndef IDOCK_LIBRARY_HPP
+#define IDOCK_LIBRARY_HPP
+
+#include <array>
+#include <cstring>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/utility/string_ref.hpp>
+#include "common.hpp"
+
+using boost::iostreams::mapped_file_source;
+using boost::string_ref;
+
+/// Represents ZINC properties of a ligand. On disk each record occupies 26 bytes without the trailing padding.
+struct zproperty
+{
+	float mwt, lgp, ads, pds;
+	int16_t hbd, hba, psa, chg, nrb;
+};
+
+/// Represents idock properties of a ligand.
+struct xproperty
+{
+	std::array<int16_t, 20> counts;
+	float mwt;
+};
+
+/// Represents a read-only array of fixed-size records memory-mapped from a binary file.
+/// Records are copied out on access, so that files with packed records of unaligned size can be served as well.
+template <typename T>
+class mapped_array
+{
+public:
+	/// Constructs an empty array.
+	mapped_array() : stride(sizeof(T)), n(0) {}
+
+	/// Maps a file whose records are stride bytes apart.
+	void open(const path& p, const size_t stride_ = sizeof(T))
+	{
+		BOOST_ASSERT(stride_ <= sizeof(T));
+		file.open(p);
+		stride = stride_;
+		n = file.size() / stride;
+	}
+
+	/// Returns the number of records.
+	size_t size() const
+	{
+		return n;
+	}
+
+	/// Returns a copy of the record at the given index.
+	T operator[](const size_t index) const
+	{
+		BOOST_ASSERT(index < n);
+		T t;
+		memcpy(&t, file.data() + stride * index, stride);
+		return t;
+	}
+
+	/// Returns a pointer to the records, which are contiguous and aligned only if the file has been mapped with the default stride.
+	const T* data() const
+	{
+		BOOST_ASSERT(stride == sizeof(T));
+		return reinterpret_cast<const T*>(file.data());
+	}
+
+private:
+	mapped_file_source file;
+	size_t stride; ///< Number of bytes between two consecutive records.
+	size_t n; ///< Number of records.
+};
+
+/// Represents a read-only array of variable-length binary records memory-mapped from a file.
+/// The ending offsets of individual records are mapped from a companion .ftr file of size_t values, the same format as used by usr.
+class blob_array
+{
+public:
+	/// Maps a file and its .ftr footer file.
+	void open(const path& p);
+
+	/// Returns true if a file has been mapped.
+	bool is_open() const
+	{
+		return file.is_open();
+	}
+
+	/// Returns true if every record lies within the mapped file, i.e. the last ending offset does not exceed the file size.
+	bool is_within_file() const
+	{
+		return !ftr.size() || ftr[ftr.size() - 1] <= file.size();
+	}
+
+	/// Returns the number of records.
+	size_t size() const
+	{
+		return ftr.size();
+	}
+
+	/// Returns a reference to the record at the given index.
+	string_ref operator[](const size_t index) const;
+
+protected:
+	mapped_file_source file;
+	mapped_array<size_t> ftr; ///< Exclusive ending offsets of records.
+};
+
+/// Represents a read-only array of newline-terminated strings memory-mapped from a text file.
+class string_array : public blob_array
+{
+public:
+	/// Returns a reference to the string at the given index, excluding the trailing newline, be it LF or CRLF.
+	string_ref operator[](const size_t index) const;
+};
+
+/// Represents a ligand library, whose size is given by a manifest file and whose metadata are memory-mapped on demand.
+class library
+{
+public:
+	/// Opens the library files prefixed with the given name, e.g. 16_manifest.conf and 16_zincid.txt.
+	/// The precompiled ligand file, e.g. 16_ligand.bin, and the structure key file, e.g. 16_key.bin, are optional.
+	/// @exception runtime_error Thrown when the manifest or any of the library files is missing or inconsistent.
+	explicit library(const string& prefix);
+
+	/// Returns a reference to the pdbqt text of the ligand at the given index, which spans from its header to the next header.
+	string_ref pdbqt(const size_t index) const;
+
+	/// Advises the kernel to read ahead the pages of the ligand at the given index, i.e. its precompiled record if available or otherwise its pdbqt text.
+	/// This call returns immediately, so that the pages can be fetched from a network filesystem while other ligands are being docked.
+	void prefetch(const size_t index) const;
+
+	size_t num_ligands; ///< Number of ligands declared by the manifest.
+	vector<size_t> splits; ///< Ascending split points of slices of equal predicted docking cost, declared by the manifest if the library has been encoded by bin/encode.
+	string_array zincids; ///< ZINC IDs.
+	string_array smileses; ///< SMILES strings.
+	string_array suppliers; ///< Supplier lists.
+	mapped_array<zproperty> zproperties; ///< ZINC properties.
+	mapped_array<xproperty> xproperties; ///< idock properties.
+	mapped_array<size_t> headers; ///< Starting offsets of ligands in the ligand file.
+	mapped_file_source pdbqts; ///< Ligand file in pdbqt format.
+	blob_array records; ///< Precompiled ligand records, mapped only if the library has been encoded by bin/encode.
+	mapped_array<uint64_t> keys; ///< Structure keys, equal for ligands of the same structure, mapped only if the library has been deduplicated by bin/dedup.
+};
+
+#endif
@@ -1,5 +1,5 @@
 #include <iomanip>
-#include <boost/algorithm/string.hpp>
+#include <cstring>
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
 #include "parsing_error.hpp"
@@ -8,10 +8,9 @@
 using boost::filesystem::ifstream;
 using boost::filesystem::ofstream;
 
-ligand::ligand(boost::filesystem::ifstream& ifs) : num_active_torsions(0)
+ligand::ligand(const string_ref pdbqt) : num_active_torsions(0)
 {
 	// Initialize necessary variables for constructing a ligand.
-	lines.reserve(200); // A ligand typically consists of <= 200 lines.
 	frames.reserve(30); // A ligand typically consists of <= 30 frames.
 	frames.push_back(frame(0, 0, 1, 0, 0, 0)); // ROOT is also treated as a frame. The parent and rotorX of ROOT frame are dummy.
 	heavy_atoms.reserve(100); // A ligand typically consists of <= 100 heavy atoms.
@@ -26,11 +25,11 @@ ligand::ligand(boost::filesystem::ifstream& ifs) : num_active_torsions(0)
 	frame* f = &frames.front(); // Pointer to the current frame.
 	f->rotorYidx = 0; // Assume the rotorY of ROOT frame is the first atom.
 	size_t num_lines = 0; // Used to track line number for reporting parsing errors, if any.
-	string line;
-	line.reserve(79); // According to PDBQT specification, the last item AutoDock atom type locates at 1-based [78, 79].
+	string_ref buf = pdbqt; // Remaining part of the buffer to parse.
+	string_ref line; // Current line, which references the buffer without copying.
 
 	// Parse ROOT, ATOM/HETATM, ENDROOT, BRANCH, ENDBRANCH, TORSDOF.
-	while (getline(ifs, line))
+	while (getline(buf, line))
 	{
 		++num_lines;
 		if (starts_with(line, "ATOM") || starts_with(line, "HETATM"))
@@ -39,18 +38,13 @@ ligand::ligand(boost::filesystem::ifstream& ifs) : num_active_torsions(0)
 			BOOST_ASSERT(current == frames.size() - 1);
 			BOOST_ASSERT(f == &frames.back());
 
-			// This line will be dumped to the output ligand file.
-			lines.push_back(line);
-
 			// Parse and validate AutoDock4 atom type.
-			const string ad_type_string = line.substr(77, isspace(line[78]) ? 1 : 2);
+			const string_ref ad_type_string = ad_type_field(line);
 			const size_t ad = parse_ad_type_string(ad_type_string);
-			if (ad == AD_TYPE_SIZE) throw parsing_error(num_lines, "Atom type " + ad_type_string + " is not supported by idock.");
+			if (ad == AD_TYPE_SIZE) throw parsing_error(num_lines, "Atom type " + ad_type_string.to_string() + " is not supported by idock.");
 
 			// Parse the Cartesian coordinate.
-			string name = line.substr(12, 4);
-			boost::algorithm::trim(name);
-			atom a(static_cast<string&&>(name), vec3(right_cast<fl>(line, 31, 38), right_cast<fl>(line, 39, 46), right_cast<fl>(line, 47, 54)), ad);
+			atom a(vec3(right_cast<fl>(line, 31, 38), right_cast<fl>(line, 39, 46), right_cast<fl>(line, 47, 54)), ad);
 
 			if (a.is_hydrogen()) // Current atom is a hydrogen.
 			{
@@ -112,9 +106,6 @@ ligand::ligand(boost::filesystem::ifstream& ifs) : num_active_torsions(0)
 		}
 		else if (starts_with(line, "BRANCH"))
 		{
-			// This line will be dumped to the output ligand file.
-			lines.push_back(line);
-
 			// Parse "BRANCH   X   Y". X and Y are right-justified and 4 characters wide.
 			const size_t rotorXsrn = right_cast<size_t>(line,  7, 10);
 			const size_t rotorYsrn = right_cast<size_t>(line, 11, 14);
@@ -142,9 +133,6 @@ ligand::ligand(boost::filesystem::ifstream& ifs) : num_active_torsions(0)
 		}
 		else if (starts_with(line, "ENDBRANCH"))
 		{
-			// This line will be dumped to the output ligand file.
-			lines.push_back(line);
-
 			// A frame may be empty, e.g. "BRANCH   4   9" is immediately followed by "ENDBRANCH   4   9".
 			// This emptiness is likely to be caused by invalid input structure, especially when all the atoms are located in the same plane.
 			if (f->habegin == heavy_atoms.size()) throw parsing_error(num_lines, "An empty BRANCH has been detected, indicating the input ligand structure is probably invalid.");
@@ -183,12 +171,12 @@ ligand::ligand(boost::filesystem::ifstream& ifs) : num_active_torsions(0)
 		}
 		else if (starts_with(line, "ROOT") || starts_with(line, "ENDROOT") || starts_with(line, "TORSDOF"))
 		{
-			// This line will be dumped to the output ligand file.
-			lines.push_back(line);
 			if (starts_with(line, "TORSDOF")) break;
 		}
 	}
-	BOOST_ASSERT(lines.size() <= num_lines); // Some lines like "REMARK", "WARNING", "TER" will not be dumped to the output ligand file.
+
+	// Keep the byte range of the parsed lines, which are only needed for writing models. Lines like "REMARK", "WARNING", "TER" in between are skipped by for_each_line().
+	source = string_ref(pdbqt.data(), buf.data() - pdbqt.data());
 	BOOST_ASSERT(current == 0); // current should remain its original value if "BRANCH" and "ENDBRANCH" properly match each other.
 	BOOST_ASSERT(f == &frames.front()); // The frame pointer should remain its original value if "BRANCH" and "ENDBRANCH" properly match each other.
 
@@ -204,7 +192,6 @@ ligand::ligand(boost::filesystem::ifstream& ifs) : num_active_torsions(0)
 	num_torsions = num_frames - 1;
 	BOOST_ASSERT(num_torsions + 1 == num_frames);
 	BOOST_ASSERT(num_torsions >= num_active_torsions);
-	BOOST_ASSERT(num_heavy_atoms + num_hydrogens + (num_torsions << 1) + 3 == lines.size()); // ATOM/HETATM lines + BRANCH/ENDBRANCH lines + ROOT/ENDROOT/TORSDOF lines == lines.size()
 	flexibility_penalty_factor = 1 / (1 + 0.05846 * (num_active_torsions + 0.5 * (num_torsions - num_active_torsions)));
 	BOOST_ASSERT(flexibility_penalty_factor <= 1);
 
@@ -282,6 +269,171 @@ ligand::ligand(boost::filesystem::ifstream& ifs) : num_active_torsions(0)
 	}
 }
 
+/// Represents the fixed-size header of a precompiled ligand record.
+struct ligand_record_header
+{
+	uint32_t num_frames;
+	uint32_t num_heavy_atoms;
+	uint32_t num_hydrogens;
+	uint32_t num_active_torsions;
+	uint32_t num_interacting_pairs;
+	uint32_t num_line_bytes; ///< Number of bytes of the newline-terminated input lines.
+	fl flexibility_penalty_factor;
+};
+
+/// Represents a frame in a precompiled ligand record.
+struct frame_record
+{
+	uint32_t parent, rotorXsrn, rotorYsrn, rotorXidx, rotorYidx, habegin, haend, hybegin, hyend, active;
+	fl parent_rotorY_to_current_rotorY[3];
+	fl parent_rotorX_to_current_rotorY[3];
+};
+
+/// Represents an atom in a precompiled ligand record. The RF-Score type is derived from the AutoDock4 type, while the XScore type is not because it may have been donorized or dehydrophobicized.
+struct atom_record
+{
+	fl coordinate[3];
+	uint32_t ad, xs;
+};
+
+/// Represents an interacting pair in a precompiled ligand record.
+struct interacting_pair_record
+{
+	uint32_t i1, i2, type_pair_index;
+};
+
+/// Copies a trivially copyable object from a possibly unaligned record and advances the record pointer.
+template<typename T>
+inline T read_record(const char*& p)
+{
+	T t;
+	memcpy(&t, p, sizeof(T));
+	p += sizeof(T);
+	return t;
+}
+
+/// Writes a trivially copyable object to a record.
+template<typename T>
+inline void write_record(std::ostream& os, const T& t)
+{
+	os.write(reinterpret_cast<const char*>(&t), sizeof(T));
+}
+
+ligand::ligand(const char* p)
+{
+	const auto h = read_record<ligand_record_header>(p);
+	num_frames = h.num_frames;
+	num_torsions = num_frames - 1;
+	num_active_torsions = h.num_active_torsions;
+	num_heavy_atoms = h.num_heavy_atoms;
+	num_hydrogens = h.num_hydrogens;
+	flexibility_penalty_factor = h.flexibility_penalty_factor;
+
+	// Restore frames.
+	frames.reserve(num_frames);
+	for (size_t k = 0; k < num_frames; ++k)
+	{
+		const auto r = read_record<frame_record>(p);
+		frames.push_back(frame(r.parent, r.rotorXsrn, r.rotorYsrn, r.rotorXidx, r.habegin, r.hybegin));
+		frame& f = frames.back();
+		f.rotorYidx = r.rotorYidx;
+		f.haend = r.haend;
+		f.hyend = r.hyend;
+		f.active = r.active != 0;
+		f.parent_rotorY_to_current_rotorY = vec3(r.parent_rotorY_to_current_rotorY[0], r.parent_rotorY_to_current_rotorY[1], r.parent_rotorY_to_current_rotorY[2]);
+		f.parent_rotorX_to_current_rotorY = vec3(r.parent_rotorX_to_current_rotorY[0], r.parent_rotorX_to_current_rotorY[1], r.parent_rotorX_to_current_rotorY[2]);
+	}
+
+	// Restore heavy atoms and hydrogens, whose coordinates are already relative to their frame origins.
+	heavy_atoms.reserve(num_heavy_atoms);
+	for (size_t i = 0; i < num_heavy_atoms; ++i)
+	{
+		const auto r = read_record<atom_record>(p);
+		heavy_atoms.push_back(atom(vec3(r.coordinate[0], r.coordinate[1], r.coordinate[2]), r.ad));
+		heavy_atoms.back().xs = r.xs;
+	}
+	hydrogens.reserve(num_hydrogens);
+	for (size_t i = 0; i < num_hydrogens; ++i)
+	{
+		const auto r = read_record<atom_record>(p);
+		hydrogens.push_back(atom(vec3(r.coordinate[0], r.coordinate[1], r.coordinate[2]), r.ad));
+		hydrogens.back().xs = r.xs;
+	}
+
+	// Restore interacting pairs.
+	interacting_pairs.reserve(h.num_interacting_pairs);
+	for (size_t i = 0; i < h.num_interacting_pairs; ++i)
+	{
+		const auto r = read_record<interacting_pair_record>(p);
+		interacting_pairs.push_back(interacting_pair(r.i1, r.i2, r.type_pair_index));
+	}
+
+	// Keep the byte range of the input lines, which are only used when writing models.
+	source = string_ref(p, h.num_line_bytes);
+}
+
+void ligand::encode(std::ostream& os) const
+{
+	ligand_record_header h;
+	h.num_frames = num_frames;
+	h.num_heavy_atoms = num_heavy_atoms;
+	h.num_hydrogens = num_hydrogens;
+	h.num_active_torsions = num_active_torsions;
+	h.num_interacting_pairs = interacting_pairs.size();
+	h.num_line_bytes = 0;
+	for_each_line([&](const string_ref line)
+	{
+		h.num_line_bytes += line.size() + 1;
+	});
+	h.flexibility_penalty_factor = flexibility_penalty_factor;
+	write_record(os, h);
+	for (const auto& f : frames)
+	{
+		frame_record r;
+		r.parent = f.parent;
+		r.rotorXsrn = f.rotorXsrn;
+		r.rotorYsrn = f.rotorYsrn;
+		r.rotorXidx = f.rotorXidx;
+		r.rotorYidx = f.rotorYidx;
+		r.habegin = f.habegin;
+		r.haend = f.haend;
+		r.hybegin = f.hybegin;
+		r.hyend = f.hyend;
+		r.active = f.active;
+		for (size_t i = 0; i < 3; ++i) // The two vectors of ROOT frame are not used and thus not initialized.
+		{
+			r.parent_rotorY_to_current_rotorY[i] = &f == &frames.front() ? 0 : f.parent_rotorY_to_current_rotorY[i];
+			r.parent_rotorX_to_current_rotorY[i] = &f == &frames.front() ? 0 : f.parent_rotorX_to_current_rotorY[i];
+		}
+		write_record(os, r);
+	}
+	for (const auto* atoms : { &heavy_atoms, &hydrogens })
+	{
+		for (const auto& a : *atoms)
+		{
+			atom_record r;
+			r.coordinate[0] = a.coordinate[0];
+			r.coordinate[1] = a.coordinate[1];
+			r.coordinate[2] = a.coordinate[2];
+			r.ad = a.ad;
+			r.xs = a.xs;
+			write_record(os, r);
+		}
+	}
+	for (const auto& p : interacting_pairs)
+	{
+		interacting_pair_record r;
+		r.i1 = p.i1;
+		r.i2 = p.i2;
+		r.type_pair_index = p.type_pair_index;
+		write_record(os, r);
+	}
+	for_each_line([&](const string_ref line)
+	{
+		os << line << '\n';
+	});
+}
+
 vector<size_t> ligand::get_atom_types() const
 {
 	vector<size_t> atom_types;
@@ -486,12 +638,30 @@ bool ligand::evaluate(const conformation& conf, const scoring_function& sf, cons
 }
 
 result ligand::compose_result(const fl e, const fl f, const conformation& conf) const
+{
+	vector<vec3> heavy_atoms(num_heavy_atoms);
+	compose(conf, heavy_atoms.data(), nullptr);
+	return result(conf, e, f, static_cast<vector<vec3>&&>(heavy_atoms));
+}
+
+void ligand::compose_heavy_atoms(const conformation& conf, vector<vec3>& heavy_atoms) const
+{
+	BOOST_ASSERT(heavy_atoms.size() == num_heavy_atoms);
+	compose(conf, heavy_atoms.data(), nullptr);
+}
+
+vector<vec3> ligand::compose_hydrogens(const conformation& conf) const
+{
+	vector<vec3> hydrogens(num_hydrogens);
+	compose(conf, nullptr, hydrogens.data());
+	return hydrogens;
+}
+
+void ligand::compose(const conformation& conf, vec3* const heavy_atoms, vec3* const hydrogens) const
 {
 	vector<vec3> origins(num_frames);
 	vector<qtn4> orientations_q(num_frames);
 	vector<mat3> orientations_m(num_frames);
-	vector<vec3> heavy_atoms(num_heavy_atoms);
-	vector<vec3> hydrogens(num_hydrogens);
 
 	origins.front() = conf.position;
 	orientations_q.front() = conf.orientation;
@@ -499,11 +669,11 @@ result ligand::compose_result(const fl e, const fl f, const conformation& conf)
 
 	// Calculate the coordinates of both heavy atoms and hydrogens of ROOT frame.
 	const frame& root = frames.front();
-	for (size_t i = root.habegin; i < root.haend; ++i)
+	for (size_t i = root.habegin; heavy_atoms && i < root.haend; ++i)
 	{
 		heavy_atoms[i] = origins.front() + orientations_m.front() * this->heavy_atoms[i].coordinate;
 	}
-	for (size_t i = root.hybegin; i < root.hyend; ++i)
+	for (size_t i = root.hybegin; hydrogens && i < root.hyend; ++i)
 	{
 		hydrogens[i]   = origins.front() + orientations_m.front() * this->hydrogens[i].coordinate;
 	}
@@ -521,55 +691,51 @@ result ligand::compose_result(const fl e, const fl f, const conformation& conf)
 		orientations_m[k] = orientations_q[k].to_mat3();
 
 		// Update coordinates.
-		for (size_t i = f.habegin; i < f.haend; ++i)
+		for (size_t i = f.habegin; heavy_atoms && i < f.haend; ++i)
 		{
 			heavy_atoms[i] = origins[k] + orientations_m[k] * this->heavy_atoms[i].coordinate;
 		}
-		for (size_t i = f.hybegin; i < f.hyend; ++i)
+		for (size_t i = f.hybegin; hydrogens && i < f.hyend; ++i)
 		{
 			hydrogens[i]   = origins[k] + orientations_m[k] * this->hydrogens[i].coordinate;
 		}
 	}
-
-	return result(conf, e, f, static_cast<vector<vec3>&&>(heavy_atoms), static_cast<vector<vec3>&&>(hydrogens));
 }
 
-void ligand::write_model(boost::iostreams::filtering_ostream& ligands_pdbqt_gz, const summary& s, const result& r, const box& b, const vector<array3d<fl>>& grid_maps)
+void ligand::write_model(text_buffer& model, const summary& s, const result& r, const box& b, const vector<array3d<fl>>& grid_maps) const
 {
 	// Dump binding conformations to the output ligand file.
-	using namespace std;
-	ligands_pdbqt_gz
-		<< "REMARK 921   NORMALIZED FREE ENERGY PREDICTED BY IDOCK:" << setw(8) << r.f * flexibility_penalty_factor << " KCAL/MOL\n"
-		<< "REMARK 922        TOTAL FREE ENERGY PREDICTED BY IDOCK:" << setw(8) << r.e       << " KCAL/MOL\n"
-		<< "REMARK 923 INTER-LIGAND FREE ENERGY PREDICTED BY IDOCK:" << setw(8) << r.f       << " KCAL/MOL\n"
-		<< "REMARK 924 INTRA-LIGAND FREE ENERGY PREDICTED BY IDOCK:" << setw(8) << (r.e - r.f) << " KCAL/MOL\n"
-		<< "REMARK 927      BINDING AFFINITY PREDICTED BY RF-SCORE:" << setw(8) << s.rfscore << " PKD\n"
+	model
+		.put("REMARK 921   NORMALIZED FREE ENERGY PREDICTED BY IDOCK:").put_fixed(r.f * flexibility_penalty_factor, 3, 8).put(" KCAL/MOL\n")
+		.put("REMARK 922        TOTAL FREE ENERGY PREDICTED BY IDOCK:").put_fixed(r.e, 3, 8).put(" KCAL/MOL\n")
+		.put("REMARK 923 INTER-LIGAND FREE ENERGY PREDICTED BY IDOCK:").put_fixed(r.f, 3, 8).put(" KCAL/MOL\n")
+		.put("REMARK 924 INTRA-LIGAND FREE ENERGY PREDICTED BY IDOCK:").put_fixed(r.e - r.f, 3, 8).put(" KCAL/MOL\n")
+		.put("REMARK 927      BINDING AFFINITY PREDICTED BY RF-SCORE:").put_fixed(s.rfscore, 3, 8).put(" PKD\n")
 	;
-	const size_t num_lines = lines.size();
+	const auto hydrogens = compose_hydrogens(r.conf);
 	size_t heavy_atom = 0, hydrogen = 0;
-	for (size_t j = 0; j < num_lines; ++j)
+	for_each_line([&](const string_ref line)
 	{
-		const string& line = lines[j];
 		if (line.size() >= 79) // This line starts with "ATOM" or "HETATM"
 		{
 			const bool is_hydrogen = line[77] == 'H' && (line[78] == ' ' || line[78] == 'D');
 			const fl   atom_energy = is_hydrogen ? 0 : grid_maps[heavy_atoms[heavy_atom].xs](b.grid_index(r.heavy_atoms[heavy_atom]));
-			const vec3& coordinate = is_hydrogen ? r.hydrogens[hydrogen++] : r.heavy_atoms[heavy_atom++];
-			ligands_pdbqt_gz
-				<< line.substr(0, 30)
-				<< setw(8) << coordinate[0]
-				<< setw(8) << coordinate[1]
-				<< setw(8) << coordinate[2]
-				<< line.substr(54, 16)
-				<< setw(6) << atom_energy
-				<< line.substr(76);
+			const vec3& coordinate = is_hydrogen ? hydrogens[hydrogen++] : r.heavy_atoms[heavy_atom++];
+			model
+				.put(line.substr(0, 30))
+				.put_fixed(coordinate[0], 3, 8)
+				.put_fixed(coordinate[1], 3, 8)
+				.put_fixed(coordinate[2], 3, 8)
+				.put(line.substr(54, 16))
+				.put_fixed(atom_energy, 3, 6)
+				.put(line.substr(76));
 		}
 		else // This line starts with "ROOT", "ENDROOT", "BRANCH", "ENDBRANCH", TORSDOF", which will not change during docking.
 		{
-			ligands_pdbqt_gz << line;
+			model.put(line);
 		}
-		ligands_pdbqt_gz << '\n';
-	}
+		model.put('\n');
+	});
 	assert(heavy_atom == r.heavy_atoms.size());
-	assert(hydrogen == r.hydrogens.size());
+	assert(hydrogen == hydrogens.size());
 }
@@ -12,6 +12,7 @@
 #include "result.hpp"
 #include "conformation.hpp"
 #include "summary.hpp"
+#include "text_buffer.hpp"
 
 using boost::filesystem::ifstream;
 using boost::filesystem::ofstream;
@@ -52,7 +53,7 @@ public:
 class ligand
 {
 public:
-	vector<string> lines; ///< Input PDBQT file lines.
+	string_ref source; ///< Byte range of the input PDBQT lines in the buffer the ligand was constructed from, which are sliced only when writing models.
 	vector<frame> frames; ///< ROOT and BRANCH frames.
 	vector<atom> heavy_atoms; ///< Heavy atoms. Coordinates are relative to frame origin, which is the first atom by default.
 	vector<atom> hydrogens; ///< Hydrogen atoms. Coordinates are relative to frame origin, which is the first atom by default.
@@ -63,21 +64,56 @@ public:
 	size_t num_active_torsions; ///< Number of active torsions.
 	fl flexibility_penalty_factor; ///< A value in (0, 1] to penalize ligand flexibility.
 
-	/// Constructs a ligand by parsing a ligand file stream in pdbqt format.
+	/// Constructs a ligand by parsing a buffer in pdbqt format in place. The buffer must outlive the ligand.
 	/// @exception parsing_error Thrown when an atom type is not recognized or an empty branch is detected.
-	ligand(boost::filesystem::ifstream& ifs);
+	explicit ligand(const string_ref pdbqt);
+
+	/// Constructs a ligand from a precompiled binary record written by encode(), without parsing. The record must outlive the ligand.
+	explicit ligand(const char* record);
+
+	/// Writes the current ligand as a precompiled binary record, which contains frames, relative coordinates, atom types, interacting pairs and input lines.
+	void encode(std::ostream& os) const;
 
 	/// Returns the XScore atom types presented in current ligand.
 	vector<size_t> get_atom_types() const;
 
+	/// Returns the number of intra-ligand interacting pairs.
+	size_t num_interacting_pairs() const
+	{
+		return interacting_pairs.size();
+	}
+
 	/// Evaluates free energy e, force f, and change g. Returns true if the conformation is accepted.
 	bool evaluate(const conformation& conf, const scoring_function& sf, const box& b, const vector<array3d<fl>>& grid_maps, const fl e_upper_bound, fl& e, fl& f, change& g) const;
 
 	/// Composes a result from free energy, inter-molecular free energy f, and conformation conf.
 	result compose_result(const fl e, const fl f, const conformation& conf) const;
 
-	/// Writes a given number of conformations from a result container into a output ligand file in PDBQT format.
-	void write_model(boost::iostreams::filtering_ostream& ligands_pdbqt_gz, const summary& s, const result& r, const box& b, const vector<array3d<fl>>& grid_maps);
+	/// Composes the heavy atom coordinates of conformation conf into a buffer of num_heavy_atoms coordinates.
+	void compose_heavy_atoms(const conformation& conf, vector<vec3>& heavy_atoms) const;
+
+	/// Composes the hydrogen coordinates of conformation conf.
+	vector<vec3> compose_hydrogens(const conformation& conf) const;
+
+	/// Calls f with each input PDBQT line that is written to models, i.e. ROOT, ENDROOT, BRANCH, ENDBRANCH, TORSDOF and ATOM/HETATM lines, in order.
+	template <typename F>
+	void for_each_line(F f) const
+	{
+		string_ref buf = source, line;
+		while (getline(buf, line))
+		{
+			if (starts_with(line, "ATOM") || starts_with(line, "HETATM") || starts_with(line, "BRANCH") || starts_with(line, "ENDBRANCH") || starts_with(line, "ROOT") || starts_with(line, "ENDROOT") || starts_with(line, "TORSDOF")) f(line);
+		}
+	}
+
+	/// Formats the docked conformation of a result as a model in PDBQT format.
+	void write_model(text_buffer& model, const summary& s, const result& r, const box& b, const vector<array3d<fl>>& grid_maps) const;
+
+	/// Returns the number of bytes the ligand occupies in memory, excluding the buffer its lines reference.
+	size_t footprint() const
+	{
+		return sizeof(ligand) + sizeof(frame) * frames.capacity() + sizeof(atom) * (heavy_atoms.capacity() + hydrogens.capacity()) + sizeof(interacting_pair) * interacting_pairs.capacity();
+	}
 
 private:
 	/// Represents a pair of interacting atoms that are separated by 3 consecutive covalent bonds.
@@ -91,6 +127,9 @@ private:
 	};
 
 	vector<interacting_pair> interacting_pairs; ///< Non 1-4 interacting pairs.
+
+	/// Composes the coordinates of conformation conf into heavy_atoms and hydrogens, either of which may be null to skip it.
+	void compose(const conformation& conf, vec3* const heavy_atoms, vec3* const hydrogens) const;
 };
 
 #endif
@@ -0,0 +1,43 @@
+#include "ligand_reader.hpp"
+#include "ligand_cache.hpp"
+
+ligand_cache::ligand_cache(const library& lib, const size_t capacity) : num_hits(0), num_misses(0), lib(lib), capacity(capacity), footprint(0)
+{
+}
+
+shared_ptr<const ligand> ligand_cache::get(const size_t index)
+{
+	{
+		lock_guard<mutex> guard(m);
+		const auto it = entries.find(index);
+		if (it != entries.end())
+		{
+			recency.splice(recency.begin(), recency, it->second.pos);
+			++num_hits;
+			return it->second.lig;
+		}
+		++num_misses;
+	}
+
+	// Load the ligand without holding the lock, so that misses of different ligands are served concurrently.
+	const shared_ptr<const ligand> lig = make_shared<ligand>(load_ligand(lib, index));
+	const size_t lig_footprint = lig->footprint();
+	if (lig_footprint > capacity) return lig;
+
+	lock_guard<mutex> guard(m);
+	const auto p = entries.emplace(index, entry());
+	if (!p.second) return p.first->second.lig; // Another task has cached the ligand meanwhile.
+	recency.push_front(index);
+	p.first->second.lig = lig;
+	p.first->second.footprint = lig_footprint;
+	p.first->second.pos = recency.begin();
+	footprint += lig_footprint;
+	while (footprint > capacity)
+	{
+		const auto victim = entries.find(recency.back());
+		footprint -= victim->second.footprint;
+		entries.erase(victim);
+		recency.pop_back();
+	}
+	return lig;
+}
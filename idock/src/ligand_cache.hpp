@@ -0,0 +1,46 @@
+#pragma once
+#ifndef IDOCK_LIGAND_CACHE_HPP
+#define IDOCK_LIGAND_CACHE_HPP
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <unordered_map>
+#include "library.hpp"
+#include "ligand.hpp"
+using namespace std;
+
+/// Represents a thread-safe in-memory cache of loaded ligands keyed by library index, shared by the docking loop and the rendering of hits across jobs.
+/// Ligands are shared as immutable objects, so that an evicted ligand stays valid for as long as a task holds it.
+/// The total footprint of cached ligands is bounded by evicting them in the order of least recent use.
+class ligand_cache
+{
+public:
+	/// Constructs an empty cache of ligands of a library, whose footprints may total at most capacity bytes.
+	explicit ligand_cache(const library& lib, const size_t capacity);
+
+	/// Returns the ligand at the given index, loading it on a miss. Concurrent misses of the same index may load it more than once.
+	/// @exception parsing_error Thrown when the ligand fails to be parsed.
+	shared_ptr<const ligand> get(const size_t index);
+
+	size_t num_hits; ///< Number of lookups served from the cache.
+	size_t num_misses; ///< Number of lookups that loaded the ligand.
+
+private:
+	/// Represents a cached ligand and its position in the recency list.
+	struct entry
+	{
+		shared_ptr<const ligand> lig;
+		size_t footprint;
+		list<size_t>::iterator pos;
+	};
+
+	const library& lib;
+	const size_t capacity; ///< Maximum total footprint of cached ligands in bytes.
+	size_t footprint; ///< Total footprint of cached ligands in bytes.
+	list<size_t> recency; ///< Indexes of cached ligands, most recently used first.
+	unordered_map<size_t, entry> entries;
+	mutex m;
+};
+
+#endif
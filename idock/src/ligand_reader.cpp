@@ -0,0 +1,85 @@
+#include "ligand_reader.hpp"
+
+ligand load_ligand(const library& lib, const size_t index)
+{
+	if (lib.records.is_open()) return ligand(lib.records[index].data());
+	return ligand(lib.pdbqt(index));
+}
+
+ligand_reader::ligand_reader(const library& lib, ligand_cache& cache, vector<size_t>&& indexes, const size_t capacity) : lib(lib), cache(cache), indexes(move(indexes)), capacity(capacity), stopped(false), finished(false), t([this]()
+{
+	run();
+})
+{
+}
+
+ligand_reader::~ligand_reader()
+{
+	{
+		lock_guard<mutex> guard(m);
+		stopped = true;
+	}
+	not_full.notify_one();
+	t.join();
+}
+
+void ligand_reader::run()
+{
+	const size_t n = indexes.size();
+	for (size_t k = 0; k < n && k < capacity; ++k)
+	{
+		lib.prefetch(indexes[k]);
+	}
+	for (size_t k = 0; k < n; ++k)
+	{
+		// The ligand capacity positions ahead will be loaded right after the current one is consumed.
+		if (k + capacity < n) lib.prefetch(indexes[k + capacity]);
+
+		entry e;
+		e.index = indexes[k];
+		try
+		{
+			e.lig = cache.get(e.index);
+		}
+		catch (...)
+		{
+			e.ep = current_exception();
+		}
+		const bool failed = static_cast<bool>(e.ep);
+		{
+			unique_lock<mutex> lock(m);
+			not_full.wait(lock, [&]()
+			{
+				return stopped || q.size() < capacity;
+			});
+			if (stopped) return;
+			q.push_back(move(e));
+		}
+		not_empty.notify_one();
+
+		// Stop reading after a failure, which the consumer will rethrow.
+		if (failed) break;
+	}
+	{
+		lock_guard<mutex> guard(m);
+		finished = true;
+	}
+	not_empty.notify_one();
+}
+
+shared_ptr<const ligand> ligand_reader::next(size_t& index)
+{
+	unique_lock<mutex> lock(m);
+	not_empty.wait(lock, [&]()
+	{
+		return finished || !q.empty();
+	});
+	if (q.empty()) return nullptr;
+	entry e = move(q.front());
+	q.pop_front();
+	lock.unlock();
+	not_full.notify_one();
+	if (e.ep) rethrow_exception(e.ep);
+	index = e.index;
+	return move(e.lig);
+}
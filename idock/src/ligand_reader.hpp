@@ -0,0 +1,54 @@
+#pragma once
+#ifndef IDOCK_LIGAND_READER_HPP
+#define IDOCK_LIGAND_READER_HPP
+
+#include <deque>
+#include <thread>
+#include <condition_variable>
+#include "library.hpp"
+#include "ligand.hpp"
+#include "ligand_cache.hpp"
+using namespace std;
+
+//! Loads the ligand at the given index, either from its precompiled record if the library has been encoded, or by parsing its pdbqt text.
+ligand load_ligand(const library& lib, const size_t index);
+
+//! Represents a reader thread that loads ligands ahead of the docking loop and hands them over through a bounded queue.
+class ligand_reader
+{
+public:
+	//! Starts reading the ligands of the given indexes in order through a ligand cache, keeping at most capacity loaded ligands ahead of the consumer.
+	explicit ligand_reader(const library& lib, ligand_cache& cache, vector<size_t>&& indexes, const size_t capacity);
+
+	//! Stops the reader thread and waits for it to exit.
+	~ligand_reader();
+
+	//! Waits for the next ligand and stores its index. Returns nullptr when all the ligands have been consumed.
+	//! Rethrows the exception, e.g. parsing_error, that the reader thread caught while loading the ligand.
+	shared_ptr<const ligand> next(size_t& index);
+private:
+	//! Represents a loaded ligand, or the exception thrown while loading it.
+	struct entry
+	{
+		size_t index;
+		shared_ptr<const ligand> lig;
+		exception_ptr ep;
+	};
+
+	//! Loads the ligands one after another, and advises the kernel to read ahead the pages of the ligands that will be loaded once the queue has room.
+	void run();
+
+	const library& lib;
+	ligand_cache& cache;
+	const vector<size_t> indexes; //!< Indexes of the ligands to load, in order.
+	const size_t capacity; //!< Maximum number of loaded ligands waiting in the queue.
+	deque<entry> q;
+	mutex m;
+	condition_variable not_empty;
+	condition_variable not_full;
+	bool stopped; //!< Set by the destructor to stop the reader thread early.
+	bool finished; //!< Set by the reader thread when no more ligands will be queued.
+	thread t;
+};
+
+#endif
@@ -1,9 +1,14 @@
+#include <numeric>
+#include <limits>
+#include <unistd.h>
 #include <boost/program_options.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
-#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/stream.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/interprocess/sync/file_lock.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
 #include <mongo/client/dbclient.h>
 #include <curl/curl.h>
 #include "io_service_pool.hpp"
@@ -14,6 +19,16 @@
 #include "monte_carlo_task.hpp"
 #include "summary.hpp"
 #include "random_forest_test.hpp"
+#include "library.hpp"
+#include "ligand_reader.hpp"
+#include "ligand_cache.hpp"
+#include "property_index.hpp"
+#include "cost_model.hpp"
+#include "result_cache.hpp"
+#include "parallel_gzip.hpp"
+#include "text_buffer.hpp"
+#include "transport.hpp"
+#include "finalizer.hpp"
 
 using namespace std;
 using namespace std::chrono;
@@ -21,6 +36,7 @@ using namespace boost::filesystem;
 using namespace boost::iostreams;
 using namespace boost::gregorian;
 using namespace boost::posix_time;
+using boost::interprocess::file_lock;
 using namespace mongo;
 using namespace bson;
 
@@ -29,25 +45,6 @@ inline static string local_time()
 	return to_simple_string(microsec_clock::local_time()) + " ";
 }
 
-struct zproperty
-{
-	float mwt, lgp, ads, pds;
-	int16_t hbd, hba, psa, chg, nrb;
-};
-
-struct xproperty
-{
-	std::array<int16_t, 20> counts;
-	float mwt;
-};
-
-size_t write_to_stringstream(const char *buffer, size_t size, size_t count, ostringstream *ss)
-{
-	assert(size == 1);
-	ss->write(buffer, count);
-	return count;
-}
-
 size_t read_from_stringstream(char *buffer, size_t size, size_t count, istringstream *ss)
 {
 	assert(size == 1);
@@ -56,6 +53,24 @@ size_t read_from_stringstream(char *buffer, size_t size, size_t count, istringst
 	return count;
 }
 
+/// Represents the outputs of a job, which are shared by its finalization steps.
+struct job_outputs
+{
+	size_t num_summaries = 0; ///< Number of ligands written to hits.csv.gz
+	size_t num_hits = 0; ///< Number of ligands written to hits.pdbqt.gz
+	long long completed = 0; ///< Completed time in milliseconds since epoch.
+};
+
+/// Represents a target of a job, i.e. a receptor and a box, against which every ligand of the job is docked.
+struct target
+{
+	box b; ///< Search space.
+	receptor rec; ///< Receptor.
+	size_t num_gm_tasks; ///< Number of grid map tasks, one per probe along the x axis.
+	vector<array3d<fl>> grid_maps; ///< Grid maps of XScore atom types, populated on the fly.
+	uint64_t cache_context; ///< Hash of the receptor, the box and the docking settings, which together with a ligand determine its result.
+};
+
 int main(int argc, char* argv[])
 {
 	// Check the required number of comand line arguments.
@@ -73,12 +88,13 @@ int main(int argc, char* argv[])
 	const path lcl_jobs_path = argv[5];
 	const bool phase2only = argc > 6;
 
-	DBClientConnection conn;
+	// Connect to host and authenticate user, once for the compute thread and once for the finalizer thread, as connections are not thread safe.
+	DBClientConnection conn, fin_conn;
+	for (auto c : { &conn, &fin_conn })
 	{
-		// Connect to host and authenticate user.
 		cout << local_time() << "Connecting to " << host << " and authenticating " << user << endl;
 		string errmsg;
-		if ((!conn.connect(host, errmsg)) || (!conn.auth("istar", user, pwd, errmsg)))
+		if ((!c->connect(host, errmsg)) || (!c->auth("istar", user, pwd, errmsg)))
 		{
 			cerr << local_time() << errmsg << endl;
 			return 1;
@@ -89,40 +105,65 @@ int main(int argc, char* argv[])
 	cout << local_time() << "Initializing constants and variables" << endl;
 	const auto collection = "istar.idock";
 	const auto jobid_fields = BSON("_id" << 1 << "scheduled" << 1);
-	const auto param_fields = BSON("_id" << 0 << "ligands" << 1 << "mwt_lb" << 1 << "mwt_ub" << 1 << "lgp_lb" << 1 << "lgp_ub" << 1 << "ads_lb" << 1 << "ads_ub" << 1 << "pds_lb" << 1 << "pds_ub" << 1 << "hbd_lb" << 1 << "hbd_ub" << 1 << "hba_lb" << 1 << "hba_ub" << 1 << "psa_lb" << 1 << "psa_ub" << 1 << "chg_lb" << 1 << "chg_ub" << 1 << "nrb_lb" << 1 << "nrb_ub" << 1);
+	const auto param_fields = BSON("_id" << 0 << "ligands" << 1 << "mwt_lb" << 1 << "mwt_ub" << 1 << "lgp_lb" << 1 << "lgp_ub" << 1 << "ads_lb" << 1 << "ads_ub" << 1 << "pds_lb" << 1 << "pds_ub" << 1 << "hbd_lb" << 1 << "hbd_ub" << 1 << "hba_lb" << 1 << "hba_ub" << 1 << "psa_lb" << 1 << "psa_ub" << 1 << "chg_lb" << 1 << "chg_ub" << 1 << "nrb_lb" << 1 << "nrb_ub" << 1 << "targets" << 1 << "granularity" << 1);
+	const auto granu_fields = BSON("_id" << 0 << "granularity" << 1);
 	const auto finis_fields = BSON("_id" << 0 << "finished" << 1);
 	const auto compt_fields = BSON("_id" << 0 << "email" << 1 << "submitted" << 1 << "description" << 1);
-	const size_t seed = system_clock::now().time_since_epoch().count();
 	const size_t num_threads = thread::hardware_concurrency();
 	const size_t num_mc_tasks = 64;
 	const fl grid_granularity = 0.08;
+	const fl max_grid_granularity = 1; // Coarsest granularity to fall back to when grid maps would exceed their memory budget.
+	const size_t grid_map_budget = getenv("IDOCK_GRID_MAP_MB") ? lexical_cast<size_t>(getenv("IDOCK_GRID_MAP_MB")) << 20 : static_cast<size_t>(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGESIZE) / 2; // Memory budget of the grid maps of a job, half of the physical memory unless overridden by the environment.
 	const fl max_ligands_per_job = 1e+6;
+	const bool publish_partial_hits = getenv("IDOCK_PARTIAL_HITS") ? lexical_cast<bool>(getenv("IDOCK_PARTIAL_HITS")) : true; // Upload the running hits as partial_hits.csv.gz whenever a slice finishes, unless the environment sets 0.
+	const bool compact_scoring_function = getenv("IDOCK_COMPACT_SCORING_FUNCTION") ? lexical_cast<bool>(getenv("IDOCK_COMPACT_SCORING_FUNCTION")) : true; // Interpolate a float scoring function table that fits in L2 cache instead of looking up a 31MB double one, unless the environment sets 0.
+	const uintmax_t result_cache_capacity = static_cast<uintmax_t>(getenv("IDOCK_RESULT_CACHE_GB") ? lexical_cast<size_t>(getenv("IDOCK_RESULT_CACHE_GB")) : 16) << 30; // Disk budget of the result cache, 16GB unless overridden by the environment.
+	const bool cache_results = result_cache_capacity > 0; // Reuse the results of ligands docked by earlier jobs against the same receptor and box, unless the environment sets a budget of 0.
+	const size_t ligand_cache_capacity = (getenv("IDOCK_LIGAND_CACHE_MB") ? lexical_cast<size_t>(getenv("IDOCK_LIGAND_CACHE_MB")) : 1024) << 20; // Memory budget of parsed ligands kept across jobs, 1GB unless overridden by the environment.
+	const bool deduplicate_ligands = getenv("IDOCK_DEDUPLICATE_LIGANDS") ? lexical_cast<bool>(getenv("IDOCK_DEDUPLICATE_LIGANDS")) : true; // Dock one ligand per structure key in a slice and copy its results to the others, if the library has been deduplicated by bin/dedup, unless the environment sets 0.
+	const result_cache cache(lcl_jobs_path / "cache", result_cache_capacity);
+	const auto hits_csv_header = "ZINC ID,idock score (kcal/mol),RF-Score (pKd),Heavy atoms,Molecular weight (g/mol),Partition coefficient xlogP,Apolar desolvation (kcal/mol),Polar desolvation (kcal/mol),Hydrogen bond donors,Hydrogen bond acceptors,Polar surface area tPSA (Å^2),Net charge,Rotatable bonds,SMILES,Substance information,Suppliers and annotations\n";
 	const auto epoch = boost::gregorian::date(1970, 1, 1);
 	const auto private_keyfile = string(getenv("HOME")) + "/.ssh/id_rsa";
 	const auto public_keyfile = private_keyfile + ".pub";
-
-	// Calculate the slice split points on the fly.
-	const size_t total_ligands = 23129083;
-	const size_t num_slices = 10;
-	const size_t num_ligands_per_slice = total_ligands / num_slices;
-	const size_t spare_ligands = total_ligands - num_ligands_per_slice * num_slices;
-	std::array<size_t, num_slices + 1> slices;
-	for (size_t i = 0, sum = 0; i <= num_slices; ++i)
+	const auto tr = make_transport(rmt_jobs_path.string(), private_keyfile, public_keyfile); // A local rmt_jobs_path stands in for the remote host.
+
+	// Map the ligand library, whose size is given by its manifest.
+	cout << local_time() << "Mapping ligand library" << endl;
+	const library lib("16");
+	const size_t total_ligands = lib.num_ligands;
+	cout << local_time() << "Found " << total_ligands << " ligands" << endl;
+
+	// Map the columns of ligand properties, precomputed by bin/encode, for fast range filtering.
+	cout << local_time() << "Mapping property index" << endl;
+	const property_index pidx("16", total_ligands);
+
+	// Read the slice split points from the manifest, where bin/encode records them so that slices have equal predicted docking costs rather than equal numbers of ligands.
+	// A library without split points is split into 10 slices of equal numbers of ligands.
+	vector<size_t> slices(1, 0);
+	if (lib.splits.empty())
+	{
+		cout << local_time() << "[warning] Library manifest has no split points, partitioning ligands into slices of equal size" << endl;
+		for (size_t s = 1; s < 10; ++s) slices.push_back(total_ligands * s / 10);
+	}
+	else
 	{
-		slices[i] = sum;
-		sum += num_ligands_per_slice + (i < spare_ligands);
+		slices.insert(slices.end(), lib.splits.begin(), lib.splits.end());
 	}
+	slices.push_back(total_ligands);
+	const size_t num_slices = slices.size() - 1;
+	const cost_model prior_costs;
+	cost_model costs;
 
 	// Initialize variables for job caching.
 	OID _id;
 	path rmt_job_path, lcl_job_path;
-	double mwt_lb, mwt_ub, lgp_lb, lgp_ub, ads_lb, ads_ub, pds_lb, pds_ub;
-	int num_ligands, hbd_lb, hbd_ub, hba_lb, hba_ub, psa_lb, psa_ub, chg_lb, chg_ub, nrb_lb, nrb_ub;
+	property_filter pf;
+	int num_ligands;
 	fl filtering_probability;
-	box b;
-	receptor rec;
-	size_t num_gm_tasks;
-	vector<array3d<fl>> grid_maps(XS_TYPE_SIZE);
+	uint64_t sampling_key;
+	vector<target> targets; // Receptors and boxes of the job, which share the loading, parsing and filtering of ligands.
+	fl job_granularity; // Grid granularity of the job, which is coarser than grid_granularity if the grid maps of its targets would exceed their memory budget.
 
 	// Initialize program options.
 	std::array<double, 3> center, size;
@@ -144,40 +185,31 @@ int main(int argc, char* argv[])
 
 	// Precalculate the scoring function in parallel.
 	cout << local_time() << "Precalculating scoring function in parallel" << endl;
-	scoring_function sf;
+	scoring_function sf(compact_scoring_function);
+	cnt.init(sf.num_rows());
+	for (size_t row = 0; row < sf.num_rows(); ++row)
 	{
-		// Precalculate reciprocal square root values.
-		vector<fl> rs(scoring_function::Num_Samples, 0);
-		for (size_t i = 0; i < scoring_function::Num_Samples; ++i)
-		{
-			rs[i] = sqrt(i * scoring_function::Factor_Inverse);
-		}
-		BOOST_ASSERT(rs.front() == 0);
-		BOOST_ASSERT(rs.back() == scoring_function::Cutoff);
-
-		// Populate the scoring function task container.
-		cnt.init(XS_TYPE_SIZE * (XS_TYPE_SIZE + 1) >> 1);
-		for (size_t t1 =  0; t1 < XS_TYPE_SIZE; ++t1)
-		for (size_t t2 = t1; t2 < XS_TYPE_SIZE; ++t2)
+		io.post([&,row]()
 		{
-			io.post([&,t1,t2]()
-			{
-				sf.precalculate(t1, t2, rs);
-				cnt.increment();
-			});
-		}
-		cnt.wait();
+			sf.precalculate(row);
+			cnt.increment();
+		});
 	}
+	cnt.wait();
 
-	// Load a random forest from file.
-	cout << local_time() << "Loading a random forest from file" << endl;
-	forest f;
-	f.load("pdbbind-refined-x42.rf");
-
-	// Initialize a MT19937 random number generator.
-	cout << local_time() << "Seeding a MT19937 RNG with " << seed << endl;
-	mt19937eng rng(seed);
-	boost::random::uniform_real_distribution<fl> u01(0, 1);
+	// Load a random forest from file. It is flattened once into a file that later runs map directly.
+	const string rf_path = "pdbbind-refined-x42.rf";
+	const string rff_path = rf_path + "f";
+	if (!exists(rff_path))
+	{
+		cout << local_time() << "Flattening the random forest into " << rff_path << endl;
+		forest f;
+		f.load(rf_path);
+		flat_forest(f).save(rff_path);
+	}
+	cout << local_time() << "Mapping the random forest from file" << endl;
+	const flat_forest f(rff_path);
+	const size_t num_rf_features = 42;
 
 	// Precalculate alpha values for determining step size in BFGS.
 	std::array<fl, num_alphas> alphas;
@@ -189,78 +221,151 @@ int main(int argc, char* argv[])
 
 	// Reserve space for containers.
 	vector<size_t> atom_types_to_populate; atom_types_to_populate.reserve(XS_TYPE_SIZE);
-	ptr_vector<ptr_vector<result>> result_containers;
-	result_containers.resize(num_mc_tasks);
-	for (auto& rc : result_containers) rc.reserve(1);
-	ptr_vector<result> results(1);
-
-	// Read ID file.
-	string line;
-	cout << local_time() << "Reading ID file" << endl;
-	vector<string> zincids(total_ligands);
+	vector<result_container> result_containers(num_mc_tasks, result_container(1));
+	vector<size_t> num_evaluations(num_mc_tasks);
+	result_container results(1);
+	const size_t max_hits = 1000; // Maximum number of ligands to be written to hits.pdbqt.gz
+
+	cout << local_time() << (lib.records.is_open() ? "Using" : "Not using") << " precompiled ligand records" << endl;
+	cout << local_time() << "Caching up to " << (ligand_cache_capacity >> 20) << "MB of parsed ligands" << endl;
+	ligand_cache ligands(lib, ligand_cache_capacity);
+
+	// Format a row of hits.csv.gz for a docked ligand.
+	const auto write_hit_row = [&](text_buffer& row, const summary& s)
 	{
-		std::ifstream ifs("16_zincid.txt");
-		for (auto& zincid : zincids)
+		const auto zincid = lib.zincids[s.index];
+		const auto zp = lib.zproperties[s.index];
+		const auto xp = lib.xproperties[s.index];
+		row
+			.put(zincid).put(',')
+			.put_fixed(s.energy, 3).put(',')
+			.put_fixed(s.rfscore, 3).put(',')
+			.put_int(xp.counts[14]).put(',')
+			.put_fixed(zp.mwt, 3).put(',')
+			.put_fixed(zp.lgp, 3).put(',')
+			.put_fixed(zp.ads, 3).put(',')
+			.put_fixed(zp.pds, 3).put(',')
+			.put_int(zp.hbd).put(',')
+			.put_int(zp.hba).put(',')
+			.put_int(zp.psa).put(',')
+			.put_int(zp.chg).put(',')
+			.put_int(zp.nrb).put(',')
+			.put(lib.smileses[s.index]).put(',')
+			.put("http://zinc.docking.org/substance/").put(zincid).put(',')
+			.put(lib.suppliers[s.index]).put('\n');
+	};
+
+	// Create grid maps of the XScore atom types of a ligand against a target on the fly if necessary. Grid map tasks run in the io service pool.
+	const auto populate_grid_maps = [&](target& tg, const vector<size_t>& ligand_atom_types)
+	{
+		auto& grid_maps = tg.grid_maps;
+		BOOST_ASSERT(atom_types_to_populate.empty());
+		for (const auto t : ligand_atom_types)
 		{
-			getline(ifs, zincid);
+			BOOST_ASSERT(t < XS_TYPE_SIZE);
+			array3d<fl>& grid_map = grid_maps[t];
+			if (grid_map.initialized()) continue; // The grid map of XScore atom type t has already been populated.
+			grid_map.resize(tg.b.num_probes); // An exception may be thrown in case memory is exhausted.
+			atom_types_to_populate.push_back(t);  // The grid map of XScore atom type t has not been populated and should be populated now.
 		}
-	}
-
-	// Read ZINC property file.
-	cout << local_time() << "Reading ZINC property file" << endl;
-	vector<zproperty> zproperties(total_ligands);
-	{
-		std::ifstream ifs("16_zprop.bin", ios::binary);
-		for (auto& p : zproperties)
+		if (atom_types_to_populate.size())
 		{
-			ifs.read(reinterpret_cast<char*>(&p), 26); // sizeof(zproperty) == 28
+			cnt.init(tg.num_gm_tasks);
+			for (size_t x = 0; x < tg.num_gm_tasks; ++x)
+			{
+				io.post([&,x]()
+				{
+					grid_map_task(grid_maps, atom_types_to_populate, x, sf, tg.b, tg.rec);
+					cnt.increment();
+				});
+			}
+			cnt.wait();
+			atom_types_to_populate.clear();
 		}
-	}
+	};
 
-	// Read SMILES file.
-	cout << local_time() << "Reading SMILES file" << endl;
-	vector<string> smileses(total_ligands);
+	// Format the docked conformation of a loaded ligand, i.e. the source of a summary, as a model of hits.pdbqt.gz under the ZINC metadata of the summary's index. Returns false if the summary does not match the ligand.
+	// The grid maps of the ligand against its target must have been populated, so that models can be formatted by concurrent tasks.
+	const auto write_hit_model = [&](text_buffer& model, const summary& s, const ligand& lig)
 	{
-		std::ifstream ifs("16_smiles.txt");
-		for (auto& smiles : smileses)
+		const target& tg = targets[s.target];
+		// Retrieve the ligand properties.
+		const auto zincid = lib.zincids[s.index];
+		const auto zp = lib.zproperties[s.index];
+		const auto xp = lib.xproperties[s.index];
+		const auto smiles = lib.smileses[s.index];
+		const auto supplier = lib.suppliers[s.index];
+
+		// Validate the correctness of the current summary.
+		if (s.conf.torsions.size() != lig.num_active_torsions)
 		{
-			getline(ifs, smiles);
+			cerr << local_time() << "[warning] Inequal numbers of torsions: ligand index = " << s.index << ", ZIND ID = " << zincid << ", lig.num_active_torsions = " << lig.num_active_torsions << ", s.conf.torsions.size() = " << s.conf.torsions.size() << endl;
+			return false;
 		}
-	}
 
-	// Read supplier file.
-	cout << local_time() << "Reading supplier file" << endl;
-	vector<string> suppliers(total_ligands);
+		// Apply conformation.
+		fl e, f;
+		change g(lig.num_active_torsions);
+		lig.evaluate(s.conf, sf, tg.b, tg.grid_maps, -99, e, f, g);
+		const auto r = lig.compose_result(e, f, s.conf);
+
+		// Format the model.
+		model
+			.put("MODEL \n")
+			.put("REMARK 911 ZINC ID: ").put(zincid).put('\n')
+			.put("REMARK 912 ZINC PROPERTIES:")
+			.put_fixed(zp.mwt, 3, 8)
+			.put_fixed(zp.lgp, 3, 8)
+			.put_fixed(zp.ads, 3, 8)
+			.put_fixed(zp.pds, 3, 8)
+			.put_int(zp.hbd, 3)
+			.put_int(zp.hba, 3)
+			.put_int(zp.psa, 3)
+			.put_int(zp.chg, 3)
+			.put_int(zp.nrb, 3)
+			.put('\n')
+			.put("REMARK 913 ZINC SMILES: ").put(smiles).put('\n')
+			.put("REMARK 914 ZINC SUPPLIERS: ").put(supplier).put('\n')
+			.put("REMARK 915 IDOCK ATOM COUNTS:");
+		for (size_t i = 0; i < 14; ++i) model.put_int(xp.counts[i], 3);
+		model.put('\n').put("REMARK 916 IDOCK ATOM COUNTS:");
+		for (size_t i = 14; i < 18; ++i) model.put_int(xp.counts[i], 3);
+		model.put('\n').put("REMARK 917 IDOCK FRAME COUNTS:");
+		for (size_t i = 18; i < 20; ++i) model.put_int(xp.counts[i], 3);
+		model
+			.put('\n')
+			.put("REMARK 918 IDOCK PROPERTIES:").put_fixed(xp.mwt, 3, 8).put('\n')
+		;
+		if (targets.size() > 1) model.put("REMARK 919 IDOCK TARGET:").put_int(s.target, 3).put('\n');
+		lig.write_model(model, s, r, tg.b, tg.grid_maps);
+		model.put("ENDMDL\n");
+		return true;
+	};
+
+	// Upload the text written by a function to a remote gzip file. Formatting, compression and transfer overlap through bounded buffers.
+	const auto upload = [&](const path& rmt_path, const function<void(ostream&)>& write)
 	{
-		std::ifstream ifs("16_supplier.txt");
-		for (auto& supplier : suppliers)
+		upload_sink sink(*tr, rmt_path.string());
+		boost::iostreams::stream<upload_sink> up(sink);
 		{
-			getline(ifs, supplier);
+			filtering_ostream fos;
+			fos.push(parallel_gzip_sink(up));
+			write(fos);
 		}
-	}
-
-	// Read idock property file.
-	cout << local_time() << "Reading idock property file" << endl;
-	vector<xproperty> xproperties(total_ligands);
-	{
-		std::ifstream ifs("16_xprop.bin", ios::binary);
-		ifs.read(reinterpret_cast<char*>(xproperties.data()), sizeof(xproperty) * total_ligands);
-	}
-
-	// Read header file.
-	cout << local_time() << "Reading header file" << endl;
-	vector<size_t> headers(total_ligands);
-	{
-		std::ifstream ifs("16_header.bin", ios::binary);
-		ifs.read(reinterpret_cast<char*>(headers.data()), sizeof(size_t) * total_ligands);
-	}
-
-	// Open ligand file for reading.
-	boost::filesystem::ifstream ligands("16_ligand.pdbqt");
+		up.close();
+		if (!sink.succeeded()) cerr << local_time() << "[warning] Failed to upload " << rmt_path << (sink.error().empty() ? "" : ": " + sink.error()) << endl;
+		return sink.succeeded();
+	};
 
 	// Initialize curl globally.
 	curl_global_init(CURL_GLOBAL_DEFAULT);
 
+	// Start the finalizer, which runs the phase 2 steps of jobs in the background.
+	finalizer fin([](const string& msg)
+	{
+		cerr << local_time() << "[warning] " << msg << endl;
+	});
+
 	cout << local_time() << "Entering event loop" << endl;
 	bool sleeping = false;
 	while (true)
@@ -307,66 +412,115 @@ int main(int argc, char* argv[])
 			cout << local_time() << "Reloading job parameters from database" << endl;
 			const auto param = conn.query(collection, QUERY("_id" << _id), 1, 0, &param_fields)->next();
 			num_ligands = param["ligands"].Int();
-			mwt_lb = param["mwt_lb"].Number();
-			mwt_ub = param["mwt_ub"].Number();
-			lgp_lb = param["lgp_lb"].Number();
-			lgp_ub = param["lgp_ub"].Number();
-			ads_lb = param["ads_lb"].Number();
-			ads_ub = param["ads_ub"].Number();
-			pds_lb = param["pds_lb"].Number();
-			pds_ub = param["pds_ub"].Number();
-			hbd_lb = param["hbd_lb"].Int();
-			hbd_ub = param["hbd_ub"].Int();
-			hba_lb = param["hba_lb"].Int();
-			hba_ub = param["hba_ub"].Int();
-			psa_lb = param["psa_lb"].Int();
-			psa_ub = param["psa_ub"].Int();
-			chg_lb = param["chg_lb"].Int();
-			chg_ub = param["chg_ub"].Int();
-			nrb_lb = param["nrb_lb"].Int();
-			nrb_ub = param["nrb_ub"].Int();
+			pf.mwt_lb = param["mwt_lb"].Number();
+			pf.mwt_ub = param["mwt_ub"].Number();
+			pf.lgp_lb = param["lgp_lb"].Number();
+			pf.lgp_ub = param["lgp_ub"].Number();
+			pf.ads_lb = param["ads_lb"].Number();
+			pf.ads_ub = param["ads_ub"].Number();
+			pf.pds_lb = param["pds_lb"].Number();
+			pf.pds_ub = param["pds_ub"].Number();
+			pf.hbd_lb = param["hbd_lb"].Int();
+			pf.hbd_ub = param["hbd_ub"].Int();
+			pf.hba_lb = param["hba_lb"].Int();
+			pf.hba_ub = param["hba_ub"].Int();
+			pf.psa_lb = param["psa_lb"].Int();
+			pf.psa_ub = param["psa_ub"].Int();
+			pf.chg_lb = param["chg_lb"].Int();
+			pf.chg_ub = param["chg_ub"].Int();
+			pf.nrb_lb = param["nrb_lb"].Int();
+			pf.nrb_ub = param["nrb_ub"].Int();
+			const size_t num_targets = param.hasField("targets") ? param["targets"].Int() : 1;
 
 			// Recalculate filtering_probability.
 			filtering_probability = max_ligands_per_job / num_ligands;
+			const auto id_str = _id.str();
+			sampling_key = hash64(id_str.data(), id_str.size());
 
 			// Initialize paths for box and receptor files.
 			rmt_job_path = rmt_jobs_path / _id.str();
 			lcl_job_path = lcl_jobs_path / _id.str();
 			create_directory(lcl_job_path);
 
-			// Read input files remotely via SSH SCP.
-			stringstream ssbox, ssrec;
-			const auto curl = curl_easy_init();
-//			curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
-			curl_easy_setopt(curl, CURLOPT_SSH_AUTH_TYPES, CURLSSH_AUTH_PUBLICKEY);
-			curl_easy_setopt(curl, CURLOPT_SSH_PRIVATE_KEYFILE, private_keyfile.c_str());
-			curl_easy_setopt(curl, CURLOPT_SSH_PUBLIC_KEYFILE, public_keyfile.c_str());
-			curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_to_stringstream);
-			cout << local_time() << "Reloading the box file" << endl;
-			curl_easy_setopt(curl, CURLOPT_URL, (rmt_job_path / "box.conf").c_str());
-			curl_easy_setopt(curl, CURLOPT_WRITEDATA, &ssbox);
-			curl_easy_perform(curl);
-			cout << local_time() << "Reloading the receptor file" << endl;
-			curl_easy_setopt(curl, CURLOPT_URL, (rmt_job_path / "receptor.pdbqt").c_str());
-			curl_easy_setopt(curl, CURLOPT_WRITEDATA, &ssrec);
-			curl_easy_perform(curl);
-			curl_easy_cleanup(curl);
-
-			// Parse the box file.
-			variables_map vm;
-			store(parse_config_file(ssbox, box_options), vm);
-			vm.notify();
-			b = box(vec3(center[0], center[1], center[2]), vec3(size[0], size[1], size[2]), grid_granularity);
-
-			// Parse the receptor file.
-			rec = receptor(ssrec, b);
-
-			// Reserve storage for grid map task container.
-			num_gm_tasks = b.num_probes[0];
-
-			// Clear grid maps.
-			grid_maps.clear();
-			grid_maps.resize(XS_TYPE_SIZE);
+			// Read the input files of the targets remotely. The first target is given by box.conf and receptor.pdbqt, and target t > 0 by box_t.conf and receptor_t.pdbqt.
+			vector<std::array<double, 3>> centers(num_targets), sizes(num_targets);
+			vector<string> receptor_texts(num_targets);
+			for (size_t t = 0; t < num_targets; ++t)
+			{
+				const auto suffix = t ? '_' + lexical_cast<string>(t) : string();
+				stringstream ssbox, ssrec;
+				cout << local_time() << "Reloading the box file of target " << t << endl;
+				tr->get((rmt_job_path / ("box" + suffix + ".conf")).string(), ssbox);
+				cout << local_time() << "Reloading the receptor file of target " << t << endl;
+				tr->get((rmt_job_path / ("receptor" + suffix + ".pdbqt")).string(), ssrec);
+
+				// Parse the box file.
+				variables_map vm;
+				store(parse_config_file(ssbox, box_options), vm);
+				vm.notify();
+				centers[t] = center;
+				sizes[t] = size;
+				receptor_texts[t] = ssrec.str();
+			}
+
+			// Estimate the memory of the grid maps of all the XScore atom types of all the targets, and coarsen the granularity until they fit in the budget.
+			// The first node to load the job records its granularity in the job, and the other nodes follow it, so that all the slices are docked alike.
+			if (param.hasField("granularity"))
+			{
+				job_granularity = param["granularity"].Number();
+			}
+			else
+			{
+				const auto estimate_bytes = [&](const fl granularity)
+				{
+					size_t bytes = 0;
+					for (size_t t = 0; t < num_targets; ++t)
+					{
+						bytes += box(vec3(centers[t][0], centers[t][1], centers[t][2]), vec3(sizes[t][0], sizes[t][1], sizes[t][2]), granularity).grid_map_bytes() * XS_TYPE_SIZE;
+					}
+					return bytes;
+				};
+				job_granularity = grid_granularity;
+				while (estimate_bytes(job_granularity) > grid_map_budget && job_granularity * 1.25 <= max_grid_granularity)
+				{
+					job_granularity *= 1.25;
+				}
+				const auto bytes = estimate_bytes(job_granularity);
+				cout << local_time() << "Using grid granularity " << job_granularity << " for grid maps of up to " << (bytes >> 20) << "MB within a budget of " << (grid_map_budget >> 20) << "MB" << endl;
+				if (bytes > grid_map_budget) cerr << local_time() << "[warning] Grid maps may exceed their memory budget even at the coarsest granularity" << endl;
+				conn.update(collection, BSON("_id" << _id << "granularity" << BSON("$exists" << false)), BSON("$set" << BSON("granularity" << job_granularity)));
+				job_granularity = conn.query(collection, QUERY("_id" << _id), 1, 0, &granu_fields)->next()["granularity"].Number(); // Another node may have recorded its granularity first.
+			}
+
+			// Load the targets of the job.
+			targets.clear();
+			targets.resize(num_targets);
+			for (size_t t = 0; t < num_targets; ++t)
+			{
+				target& tg = targets[t];
+				const auto& center = centers[t];
+				const auto& size = sizes[t];
+				tg.b = box(vec3(center[0], center[1], center[2]), vec3(size[0], size[1], size[2]), job_granularity);
+
+				// Parse the receptor file.
+				tg.rec = receptor(receptor_texts[t], tg.b);
+
+				// Derive the cache context of the target. The library and the random forest are identified by their names, and the settings by their values.
+				{
+					ostringstream context;
+					context << "idock result cache 4\n" << lib.num_ligands << ' ' << rff_path << ' ' << num_mc_tasks << ' ' << job_granularity << ' ' << compact_scoring_function << '\n';
+					for (size_t i = 0; i < 3; ++i) context << center[i] << ' ' << size[i] << '\n';
+					context << receptor_texts[t];
+					const auto context_str = context.str();
+					tg.cache_context = hash64(context_str.data(), context_str.size());
+				}
+
+				// Reserve storage for grid map task container.
+				tg.num_gm_tasks = tg.b.num_probes[0];
+
+				// Grid maps are populated on the fly.
+				tg.grid_maps.resize(XS_TYPE_SIZE);
+			}
 		}
 
 		if (!phase2only)
@@ -376,388 +530,664 @@ int main(int argc, char* argv[])
 			const auto slice_key = lexical_cast<string>(slice);
 			const auto beg_lig = slices[slice];
 			const auto end_lig = slices[slice + 1];
-			boost::filesystem::ofstream slice_csv(lcl_job_path / (slice_key + ".csv"));
-			slice_csv.setf(ios::fixed, ios::floatfield);
-			slice_csv << setprecision(12); // Dump as many digits as possible in order to recover accurate conformations in summaries.
-			for (auto idx = beg_lig; idx < end_lig; ++idx)
+			const size_t num_targets = targets.size();
+			vector<summary> target_summaries; // Results of the ligands against each target.
+			vector<summary> slice_summaries; // Consensus results of the ligands, i.e. their best results across the targets.
+			vector<float> rf_features; // num_rf_features per newly docked target summary.
+
+			// Determine the ligands to dock in this slice, in chunks in parallel.
+			// The sampling decision of a ligand depends only on the job id and the ligand index, so the selection is the same whatever the slicing and chunking.
+			const size_t num_chunks = num_threads;
+			vector<vector<size_t>> chunk_indexes(num_chunks);
+			cnt.init(num_chunks);
+			for (size_t c = 0; c < num_chunks; ++c)
 			{
-				// Check if the ligand satisfies the filtering conditions.
-				const auto zp = zproperties[idx];
-				if (!(mwt_lb <= zp.mwt && zp.mwt <= mwt_ub
-				   && lgp_lb <= zp.lgp && zp.lgp <= lgp_ub
-				   && ads_lb <= zp.ads && zp.ads <= ads_ub
-				   && pds_lb <= zp.pds && zp.pds <= pds_ub
-				   && hbd_lb <= zp.hbd && zp.hbd <= hbd_ub
-				   && hba_lb <= zp.hba && zp.hba <= hba_ub
-				   && psa_lb <= zp.psa && zp.psa <= psa_ub
-				   && chg_lb <= zp.chg && zp.chg <= chg_ub
-				   && nrb_lb <= zp.nrb && zp.nrb <= nrb_ub)) continue;
-
-				// Filtering out the ligand randomly according to the maximum number of ligands per job.
-				if (u01(rng) > filtering_probability) continue;
-
-				// Locate a ligand.
-				ligands.seekg(headers[idx]);
-
-				// Parse the ligand.
-				ligand lig(ligands);
-
-				// Create grid maps on the fly if necessary.
-				BOOST_ASSERT(atom_types_to_populate.empty());
-				const vector<size_t> ligand_atom_types = lig.get_atom_types();
-				for (const auto t : ligand_atom_types)
-				{
-					BOOST_ASSERT(t < XS_TYPE_SIZE);
-					array3d<fl>& grid_map = grid_maps[t];
-					if (grid_map.initialized()) continue; // The grid map of XScore atom type t has already been populated.
-					grid_map.resize(b.num_probes); // An exception may be thrown in case memory is exhausted.
-					atom_types_to_populate.push_back(t);  // The grid map of XScore atom type t has not been populated and should be populated now.
+				io.post([&,c]()
+				{
+					const auto beg = beg_lig + (end_lig - beg_lig) * c / num_chunks;
+					const auto end = beg_lig + (end_lig - beg_lig) * (c + 1) / num_chunks;
+					for (const auto idx : pidx.select(pf, beg, end)) // Ligands that satisfy the filtering conditions.
+					{
+						// Filtering out the ligand randomly according to the maximum number of ligands per job.
+						if (!sampled(sampling_key, idx, filtering_probability)) continue;
+
+						// Skip the ligand if it failed to be precompiled.
+						if (lib.records.is_open() && lib.records[idx].empty()) continue;
+
+						chunk_indexes[c].push_back(idx);
+					}
+					cnt.increment();
+				});
+			}
+			cnt.wait();
+			vector<size_t> indexes;
+			for (const auto& ci : chunk_indexes)
+			{
+				indexes.insert(indexes.end(), ci.begin(), ci.end());
+			}
+
+			// Take the results of the ligands found in the cache of every target, and dock the rest.
+			// A ligand found in the cache of some targets only is docked against the other targets.
+			vector<unordered_map<size_t, summary>> cached(num_targets);
+			vector<summary> cached_summaries;
+			if (cache_results)
+			{
+				for (size_t t = 0; t < num_targets; ++t)
+				{
+					cached[t] = cache.load(targets[t].cache_context, beg_lig, end_lig);
 				}
-				if (atom_types_to_populate.size())
+				size_t num_cached = 0;
+				indexes.erase(remove_if(indexes.begin(), indexes.end(), [&](const size_t i)
+				{
+					size_t num_found = 0;
+					for (size_t t = 0; t < num_targets; ++t)
+					{
+						const auto it = cached[t].find(i);
+						if (it == cached[t].end()) continue;
+						++num_found;
+						if (it->second.energy == numeric_limits<fl>::infinity()) continue; // An infinite energy records a ligand that could not be docked.
+						cached_summaries.push_back(it->second);
+						cached_summaries.back().target = t;
+					}
+					if (num_found < num_targets) return false;
+					++num_cached;
+					return true;
+				}), indexes.end());
+				cout << local_time() << "Found " << num_cached << " ligands in the result cache" << endl;
+				if (num_cached) conn.update(collection, BSON("_id" << _id), BSON("$inc" << BSON(slice_key << static_cast<long long>(num_cached))));
+			}
+			vector<vector<size_t>> undocked(num_targets); // Ligands for which no conformation was found against each target, recorded in the cache so as not to be docked again.
+
+			// Dock only the ligand of the smallest index of each structure key, and copy its results to its duplicates after docking.
+			// Duplicates share the structure but not necessarily the input coordinates, so the copies keep the docked ligand as their source, from which their models are rendered.
+			// The result reported for a duplicate is thus that of whichever ligand of its structure the job sampled first, and may differ slightly from docking the duplicate itself.
+			unordered_map<size_t, vector<size_t>> duplicates; // Duplicates of each ligand to dock.
+			if (deduplicate_ligands && lib.keys.size())
+			{
+				unordered_map<uint64_t, size_t> representatives; // Ligand to dock of each structure key.
+				representatives.reserve(indexes.size());
+				size_t num_duplicates = 0;
+				indexes.erase(remove_if(indexes.begin(), indexes.end(), [&](const size_t i)
+				{
+					const auto it = representatives.emplace(lib.keys[i], i);
+					if (it.second) return false;
+					duplicates[it.first->second].push_back(i);
+					++num_duplicates;
+					return true;
+				}), indexes.end());
+				cout << local_time() << "Found " << num_duplicates << " ligands of duplicate structures" << endl;
+				if (num_duplicates) conn.update(collection, BSON("_id" << _id), BSON("$inc" << BSON(slice_key << static_cast<long long>(num_duplicates))));
+			}
+
+			// Dock the ligands longest-first by their prior predicted costs, so that the cost model sees the whole range of ligand sizes early and the remaining work shrinks steadily.
+			// Ties are broken by index, so that the order does not depend on the costs observed by this node.
+			{
+				vector<pair<double, size_t>> prioritized;
+				prioritized.reserve(indexes.size());
+				for (const auto i : indexes)
+				{
+					prioritized.emplace_back(-prior_costs.predict(lib, i), i);
+				}
+				sort(prioritized.begin(), prioritized.end());
+				for (size_t i = 0; i < indexes.size(); ++i)
+				{
+					indexes[i] = prioritized[i].second;
+				}
+			}
+			const size_t num_indexes = indexes.size();
+			cout << local_time() << "Docking " << num_indexes << " ligands against " << num_targets << " targets" << endl;
+
+			// Load the ligands ahead of docking in a reader thread, so that disk and network latency overlaps with Monte Carlo tasks.
+			// Each ligand is loaded, parsed and filtered once, and docked against every target it has no cached result for.
+			ligand_reader reader(lib, ligands, vector<size_t>(indexes), 16);
+			size_t idx;
+			for (size_t num_docked = 0; const auto plig = reader.next(idx); ++num_docked)
+			{
+				const ligand& lig = *plig;
+				const auto atom_types = lig.get_atom_types();
+				for (size_t t = 0; t < num_targets; ++t)
 				{
-					cnt.init(num_gm_tasks);
-					for (size_t x = 0; x < num_gm_tasks; ++x)
+					if (cached[t].count(idx)) continue;
+					target& tg = targets[t];
+
+					// Run Monte Carlo tasks in parallel.
+					// Their random streams are keyed by the cache context of the target and the ligand rather than by the job, so that docking a ligand is reproducible whatever the job, the slicing and the number of threads,
+					// and a cached result is exactly what docking the ligand afresh would give.
+					const uint64_t ligand_key = mix64(tg.cache_context ^ mix64(idx));
+
+					// Create grid maps on the fly if necessary.
+					populate_grid_maps(tg, atom_types);
+
+					// Time the Monte Carlo tasks only, so that the cost model is not charged for building grid maps shared by later ligands.
+					const auto ligand_start = steady_clock::now();
+					cnt.init(num_mc_tasks);
+					for (size_t i = 0; i < num_mc_tasks; ++i)
 					{
-						io.post([&,x]()
+						BOOST_ASSERT(result_containers[i].empty());
+						BOOST_ASSERT(result_containers[i].capacity() == 1);
+						io.post([&,i,ligand_key]()
 						{
-							grid_map_task(grid_maps, atom_types_to_populate, x, sf, b, rec);
+							num_evaluations[i] = monte_carlo_task(result_containers[i], lig, ligand_key, static_cast<uint32_t>(i), alphas, sf, tg.b, tg.grid_maps);
 							cnt.increment();
 						});
 					}
 					cnt.wait();
-					atom_types_to_populate.clear();
+					costs.record(lig.num_heavy_atoms, lig.num_active_torsions, lig.num_interacting_pairs(), duration_cast<duration<double>>(steady_clock::now() - ligand_start).count(), accumulate(num_evaluations.begin(), num_evaluations.end(), static_cast<size_t>(0)));
+
+					// Merge results from all the tasks into one single result container.
+					BOOST_ASSERT(results.empty());
+					BOOST_ASSERT(results.capacity() == 1);
+					const fl required_square_error = static_cast<fl>(4 * lig.num_heavy_atoms); // Ligands with RMSD < 2.0 will be clustered into the same cluster.
+					for (size_t i = 0; i < num_mc_tasks; ++i)
+					{
+						result_container& task_results = result_containers[i];
+						BOOST_ASSERT(task_results.capacity() == 1);
+						for (const auto& task_result : task_results)
+						{
+							results.add(task_result.conf, task_result.e, task_result.f, task_result.heavy_atoms, required_square_error);
+						}
+						task_results.clear();
+					}
+
+					// No conformation can be found if the search space is too small.
+					if (results.size())
+					{
+						BOOST_ASSERT(results.size() == 1);
+						const result& r = results.front();
+
+						// Extract the random forest features of the conformation, which are scored with the rest of the slice.
+						rf_features.resize(rf_features.size() + num_rf_features);
+						float* const v = &rf_features[rf_features.size() - num_rf_features];
+						for (size_t i = 0; i < lig.num_heavy_atoms; ++i)
+						{
+							const auto& la = lig.heavy_atoms[i];
+							if (la.rf == RF_TYPE_SIZE) continue;
+							tg.rec.for_each_rf_neighbor(r.heavy_atoms[i], [&](const atom& ra, const fl dist_sqr)
+							{
+								++v[(la.rf << 2) + ra.rf];
+								if (dist_sqr >= 64) return; // Vina score cutoff 8A
+								if (la.xs != XS_TYPE_SIZE && ra.xs != XS_TYPE_SIZE)
+								{
+									sf.score(v + 36, la.xs, ra.xs, dist_sqr);
+								}
+							});
+						}
+						v[num_rf_features - 1] = lig.flexibility_penalty_factor;
+
+						// Save ligand result against the target.
+						target_summaries.push_back(summary(idx, r.f * lig.flexibility_penalty_factor, 0, r.conf, t));
+
+						// Clear the results of the current ligand.
+						results.clear();
+					}
+					else
+					{
+						undocked[t].push_back(idx);
+					}
+				}
+
+				// Report progress, and estimate the remaining time of the slice with the fitted cost model every 1000 ligands.
+				conn.update(collection, BSON("_id" << _id), BSON("$inc" << BSON(slice_key << 1)));
+				if ((num_docked + 1) % 1000 == 0)
+				{
+					double eta = 0;
+					for (size_t i = num_docked + 1; i < num_indexes; ++i)
+					{
+						eta += costs.predict(lib, indexes[i]);
+					}
+					eta *= num_targets;
+					cout << local_time() << "Docked " << num_docked + 1 << " of " << num_indexes << " ligands at " << costs.total_evaluations / costs.total_seconds << " evaluations per second, ETA " << static_cast<size_t>(eta) << " seconds" << endl;
 				}
+			}
+
+			cout << local_time() << "Served " << ligands.num_hits << " of " << ligands.num_hits + ligands.num_misses << " ligand loads from the ligand cache so far" << endl;
 
-				// Run Monte Carlo tasks in parallel.
-				cnt.init(num_mc_tasks);
-				for (size_t i = 0; i < num_mc_tasks; ++i)
+			// Rescore the newly docked conformations with the random forest, in batches in parallel.
+			{
+				const size_t num_summaries = target_summaries.size();
+				vector<float> rfscores(num_summaries);
+				const size_t num_batches = min<size_t>(num_threads, (num_summaries + 63) / 64);
+				cnt.init(num_batches);
+				for (size_t c = 0; c < num_batches; ++c)
 				{
-					BOOST_ASSERT(result_containers[i].empty());
-					BOOST_ASSERT(result_containers[i].capacity() == 1);
-					const size_t s = rng();
-					io.post([&,i,s]()
+					io.post([&,c]()
 					{
-						monte_carlo_task(result_containers[i], lig, s, alphas, sf, b, grid_maps);
+						const auto beg = num_summaries * c / num_batches;
+						const auto end = num_summaries * (c + 1) / num_batches;
+						f(rf_features.data() + beg * num_rf_features, num_rf_features, end - beg, rfscores.data() + beg);
 						cnt.increment();
 					});
 				}
 				cnt.wait();
+				for (size_t i = 0; i < num_summaries; ++i)
+				{
+					target_summaries[i].rfscore = rfscores[i];
+				}
+			}
 
-				// Merge results from all the tasks into one single result container.
-				BOOST_ASSERT(results.empty());
-				BOOST_ASSERT(results.capacity() == 1);
-				const fl required_square_error = static_cast<fl>(4 * lig.num_heavy_atoms); // Ligands with RMSD < 2.0 will be clustered into the same cluster.
-				for (size_t i = 0; i < num_mc_tasks; ++i)
+			// Save the newly docked ligands to the cache of their targets, before their results are copied to their duplicates.
+			// Copies are not cached, because the ligand a duplicate borrows from depends on the sampling of the job, and a cached result must be what docking the ligand itself would give.
+			// They are rebuilt below from the fresh or cached results of the docked ligands instead.
+			if (cache_results)
+			{
+				for (size_t t = 0; t < num_targets; ++t)
 				{
-					ptr_vector<result>& task_results = result_containers[i];
-					BOOST_ASSERT(task_results.capacity() == 1);
-					for (auto& task_result : task_results)
+					vector<summary> fresh_summaries;
+					for (const auto& s : target_summaries)
+					{
+						if (s.target == t && s.index == s.source) fresh_summaries.push_back(s);
+					}
+					for (const auto i : undocked[t])
+					{
+						fresh_summaries.push_back(summary(i, numeric_limits<fl>::infinity(), 0, conformation(0), t));
+					}
+					try
+					{
+						cache.store(targets[t].cache_context, beg_lig, end_lig, fresh_summaries);
+					}
+					catch (const exception& e)
 					{
-						add_to_result_container(results, static_cast<result&&>(task_result), required_square_error);
+						cerr << local_time() << "[warning] Failed to store results of target " << t << " in the cache: " << e.what() << endl;
 					}
-					task_results.clear();
 				}
+			}
 
-				// No conformation can be found if the search space is too small.
-				if (results.size())
+			// Copy the results of the docked ligands to their duplicates, except against the targets that a duplicate has a cached result for.
+			if (!duplicates.empty())
+			{
+				const size_t num_fresh = target_summaries.size();
+				for (size_t k = 0; k < num_fresh; ++k)
 				{
-					BOOST_ASSERT(results.size() == 1);
-					const result& r = results.front();
+					const auto it = duplicates.find(target_summaries[k].index);
+					if (it == duplicates.end()) continue;
+					const summary s = target_summaries[k];
+					for (const auto d : it->second)
+					{
+						if (cached[s.target].count(d)) continue;
+						target_summaries.push_back(s);
+						target_summaries.back().index = d;
+					}
+				}
+				for (size_t t = 0; t < num_targets; ++t)
+				{
+					const size_t num_undocked = undocked[t].size();
+					for (size_t k = 0; k < num_undocked; ++k)
+					{
+						const auto it = duplicates.find(undocked[t][k]);
+						if (it == duplicates.end()) continue;
+						for (const auto d : it->second)
+						{
+							if (!cached[t].count(d)) undocked[t].push_back(d);
+						}
+					}
 
-					// Rescore conformations with random forest.
-					vector<float> v(42);
-					for (size_t i = 0; i < lig.num_heavy_atoms; ++i)
+					// A docked ligand may have had a cached result against this target.
+					for (const auto& p : duplicates)
 					{
-						const auto& la = lig.heavy_atoms[i];
-						if (la.rf == RF_TYPE_SIZE) continue;
-						for (const auto& ra : rec.atoms)
+						const auto it = cached[t].find(p.first);
+						if (it == cached[t].end()) continue;
+						for (const auto d : p.second)
 						{
-							if (ra.rf == RF_TYPE_SIZE) continue;
-							const auto dist_sqr = distance_sqr(r.heavy_atoms[i], ra.coordinate);
-							if (dist_sqr >= 144) continue; // RF-Score cutoff 12A
-							++v[(la.rf << 2) + ra.rf];
-							if (dist_sqr >= 64) continue; // Vina score cutoff 8A
-							if (la.xs != XS_TYPE_SIZE && ra.xs != XS_TYPE_SIZE)
+							if (cached[t].count(d)) continue;
+							if (it->second.energy == numeric_limits<fl>::infinity())
 							{
-								sf.score(v.data() + 36, la.xs, ra.xs, dist_sqr);
+								undocked[t].push_back(d);
+								continue;
 							}
+							target_summaries.push_back(it->second);
+							target_summaries.back().index = d;
+							target_summaries.back().target = t;
 						}
 					}
-					v.back() = lig.flexibility_penalty_factor;
-					const auto rfscore = f(v);
-
-					// Dump ligand result to the slice csv file.
-					slice_csv << idx << ',' << (r.f * lig.flexibility_penalty_factor) << ',' << rfscore;
-					const auto& p = r.conf.position;
-					const auto& q = r.conf.orientation;
-					slice_csv << ',' << p[0] << ',' << p[1] << ',' << p[2] << ',' << q.a << ',' << q.b << ',' << q.c << ',' << q.d;
-					for (const auto t : r.conf.torsions)
-					{
-						slice_csv << ',' << t;
-					}
-					slice_csv << '\n';
-
-					// Clear the results of the current ligand.
-					results.clear();
 				}
-
-				// Report progress.
-				conn.update(collection, BSON("_id" << _id), BSON("$inc" << BSON(slice_key << 1)));
 			}
 
-			cout << local_time() << "Closing slice csv" << endl;
-			slice_csv.close();
-
-			// Increment the finished slice counter.
-			cout << local_time() << "Incrementing the finished slice counter" << endl;
-			BSONObj finis_obj;
-			conn.runCommand("istar", BSON("findandmodify" << "idock" << "query" << BSON("_id" << _id) << "update" << BSON("$inc" << BSON("finished" << 1)) << "fields" << finis_fields), finis_obj);
-			if (finis_obj["value"].Obj()["finished"].Int() + 1 < num_slices) continue;
-		}
+			// Add the cached results.
+			target_summaries.insert(target_summaries.end(), cached_summaries.begin(), cached_summaries.end());
 
-		// Combine slice csv files. Phase 2 starts here.
-		cout << local_time() << "Combining slice csv files" << endl;
-		ptr_vector<summary> summaries(num_ligands);
-		for (size_t s = 0; s < num_slices; ++s)
-		{
-			// Parse slice csv.
-			const auto slice_csv_path = lcl_job_path / (lexical_cast<string>(s) + ".csv");
-			for (boost::filesystem::ifstream slice_csv(slice_csv_path); getline(slice_csv, line);)
+			// Take the best result of each ligand across the targets as its consensus result, which ranks the ligand in the hits of the job.
+			sort(target_summaries.begin(), target_summaries.end(), [](const summary& x, const summary& y)
+			{
+				return x.index < y.index || (x.index == y.index && x.target < y.target);
+			});
+			for (size_t i = 0, j; i < target_summaries.size(); i = j)
 			{
-				vector<string> tokens;
-				tokens.reserve(10);
-				for (size_t comma0 = 0; true;)
+				size_t best = i;
+				for (j = i + 1; j < target_summaries.size() && target_summaries[j].index == target_summaries[i].index; ++j)
 				{
-					const size_t comma1 = line.find(',', comma0 + 1);
-					if (comma1 == string::npos)
-					{
-						tokens.push_back(line.substr(comma0));
-						break;
-					}
-					tokens.push_back(line.substr(comma0, comma1 - comma0));
-					comma0 = comma1 + 1;
+					if (target_summaries[j] < target_summaries[best]) best = j;
 				}
-				// Ignore incorrect lines.
-				if (tokens.size() < 10) continue;
-				try
-				{
-					conformation conf(tokens.size() - 10);
-					conf.position = vec3(lexical_cast<fl>(tokens[3]), lexical_cast<fl>(tokens[4]), lexical_cast<fl>(tokens[5]));
-					conf.orientation = qtn4(lexical_cast<fl>(tokens[6]), lexical_cast<fl>(tokens[7]), lexical_cast<fl>(tokens[8]), lexical_cast<fl>(tokens[9]));
-					for (size_t i = 0; i < conf.torsions.size(); ++i)
+				slice_summaries.push_back(target_summaries[best]);
+			}
+
+			// Write the per-target results of the slice in ascending order of ligand index, one row per ligand, so that phase 2 only needs to concatenate slices.
+			if (num_targets > 1)
+			{
+				boost::filesystem::ofstream slice_csv(lcl_job_path / (slice_key + "_targets.csv"));
+				text_buffer rows(1 << 16);
+				for (size_t i = 0, j; i < target_summaries.size(); i = j)
+				{
+					rows.put(lib.zincids[target_summaries[i].index]);
+					j = i;
+					for (size_t t = 0; t < num_targets; ++t)
 					{
-						conf.torsions[i] = lexical_cast<fl>(tokens[10 + i]);
+						if (j < target_summaries.size() && target_summaries[j].index == target_summaries[i].index && target_summaries[j].target == t)
+						{
+							rows.put(',').put_fixed(target_summaries[j].energy, 3).put(',').put_fixed(target_summaries[j].rfscore, 3);
+							++j;
+						}
+						else
+						{
+							rows.put(",,");
+						}
 					}
-					summaries.push_back(new summary(lexical_cast<size_t>(tokens[0]), lexical_cast<fl>(tokens[1]), lexical_cast<fl>(tokens[2]), conf));
+					rows.put('\n');
+					if (rows.size() >= 1 << 16) rows.flush(slice_csv);
 				}
-				catch (...)
+				rows.flush(slice_csv);
+			}
+
+			// Write the results of the slice in ascending order of energy, so that phase 2 only needs to merge slices.
+			cout << local_time() << "Writing slice result file of " << slice_summaries.size() << " ligands" << endl;
+			sort(slice_summaries.begin(), slice_summaries.end());
+			{
+				boost::filesystem::ofstream slice_bin(lcl_job_path / (slice_key + ".bin"), ios::binary);
+				for (const auto& s : slice_summaries)
 				{
+					write_summary(slice_bin, s);
 				}
 			}
-		}
 
-		// Sort summaries.
-		const auto num_summaries = summaries.size(); // Number of ligands to be written to hits.csv.gz
-		cout << local_time() << "Sorting " << num_summaries << " ligands" << endl;
-		summaries.sort();
-		const auto num_hits = min<size_t>(num_summaries, 1000); // Number of ligands to be written to hits.pdbqt.gz
-		BOOST_ASSERT(num_hits <= num_ligands);
-
-		// Write results for successfully docked ligands.
-		cout << local_time() << "Writing output streams" << endl;
-		stringstream sslog, sslig;
-		{
-			filtering_ostream foslog;
-			filtering_ostream foslig;
-			foslog.push(gzip_compressor());
-			foslig.push(gzip_compressor());
-			foslog.push(sslog);
-			foslig.push(sslig);
-			foslog.setf(ios::fixed, ios::floatfield);
-			foslig.setf(ios::fixed, ios::floatfield);
-			foslog << "ZINC ID,idock score (kcal/mol),RF-Score (pKd),Heavy atoms,Molecular weight (g/mol),Partition coefficient xlogP,Apolar desolvation (kcal/mol),Polar desolvation (kcal/mol),Hydrogen bond donors,Hydrogen bond acceptors,Polar surface area tPSA (Å^2),Net charge,Rotatable bonds,SMILES,Substance information,Suppliers and annotations\n" << setprecision(3);
-			foslig << "REMARK 901 FILE VERSION: 1.0.0\n" << setprecision(3);
-			for (auto idx = 0; idx < num_summaries; ++idx)
+			// Fold the best results of the slice into the running hits of the job, and render the models of the newcomers.
+			// Slices finishing concurrently on other nodes are serialized by a lock file in the job directory.
+			cout << local_time() << "Folding slice results into running hits" << endl;
 			{
-				// Retrieve the ligand properties.
-				const auto& s = summaries[idx];
-				const auto zincid = zincids[s.index];
-				const auto zp = zproperties[s.index];
-				const auto xp = xproperties[s.index];
-				const auto smiles = smileses[s.index];
-				const auto supplier = suppliers[s.index];
-
-				// Write to log stream.
-				foslog
-					<< zincid << ','
-					<< s.energy << ','
-					<< s.rfscore << ','
-					<< xp.counts[14] << ','
-					<< zp.mwt << ','
-					<< zp.lgp << ','
-					<< zp.ads << ','
-					<< zp.pds << ','
-					<< zp.hbd << ','
-					<< zp.hba << ','
-					<< zp.psa << ','
-					<< zp.chg << ','
-					<< zp.nrb << ','
-					<< smiles << ','
-					<< "http://zinc.docking.org/substance/" << zincid << ','
-					<< supplier << '\n';
-
-				// Only write conformations of the top ligands to hits.pdbqt.gz.
-				if (idx >= num_hits) continue;
-
-				// Locate and parse the ligand.
-				ligands.seekg(headers[s.index]);
-				ligand lig(ligands);
-
-				// Validate the correctness of the current summary.
-				if (s.conf.torsions.size() != lig.num_active_torsions)
-				{
-					cerr << local_time() << "[warning] Inequal numbers of torsions: ligand index = " << s.index << ", ZIND ID = " << zincid << ", lig.num_active_torsions = " << lig.num_active_torsions << ", s.conf.torsions.size() = " << s.conf.torsions.size() << endl;
-					continue;
+				const auto lock_path = lcl_job_path / "hits.lock";
+				boost::filesystem::ofstream(lock_path, ios::app).close();
+				file_lock lock(lock_path.c_str());
+				const boost::interprocess::scoped_lock<file_lock> guard(lock);
+				vector<summary> hits;
+				hits.reserve(max_hits << 1);
+				{
+					boost::filesystem::ifstream hits_bin(lcl_job_path / "hits.bin", ios::binary);
+					for (summary s(0, 0, 0, conformation(0)); read_summary(hits_bin, s);)
+					{
+						hits.push_back(s);
+					}
+				}
+				const auto num_old_hits = hits.size();
+				hits.insert(hits.end(), slice_summaries.begin(), slice_summaries.begin() + min(slice_summaries.size(), max_hits));
+				inplace_merge(hits.begin(), hits.begin() + num_old_hits, hits.end()); // Ties are broken by index, as in the merge of phase 2, whatever the order in which slices are folded.
+				if (hits.size() > max_hits) hits.erase(hits.begin() + max_hits, hits.end());
+
+				// Load the newcomers in parallel, and populate the grid maps they need.
+				// Exceptions are passed back from the tasks, as one escaping a task would end its thread of the pool and leave cnt.wait() waiting forever.
+				vector<const summary*> newcomers;
+				for (const auto& s : hits)
+				{
+					if (!exists(lcl_job_path / (lexical_cast<string>(s.index) + ".pdbqt"))) newcomers.push_back(&s);
+				}
+				const auto num_newcomers = newcomers.size();
+				vector<shared_ptr<const ligand>> newcomer_ligands(num_newcomers);
+				vector<exception_ptr> newcomer_failures(num_newcomers); // Exception that failed the loading or rendering of each newcomer.
+				cnt.init(num_newcomers);
+				for (size_t i = 0; i < num_newcomers; ++i)
+				{
+					io.post([&,i]()
+					{
+						try
+						{
+							newcomer_ligands[i] = ligands.get(newcomers[i]->source);
+						}
+						catch (...)
+						{
+							newcomer_failures[i] = current_exception();
+						}
+						cnt.increment();
+					});
+				}
+				cnt.wait();
+				vector<vector<size_t>> newcomer_atom_types(num_targets); // Atom types of the newcomers docked against each target.
+				for (size_t i = 0; i < num_newcomers; ++i)
+				{
+					if (newcomer_failures[i]) continue;
+					auto& types = newcomer_atom_types[newcomers[i]->target];
+					for (const auto t : newcomer_ligands[i]->get_atom_types())
+					{
+						if (find(types.begin(), types.end(), t) == types.end()) types.push_back(t);
+					}
+				}
+				for (size_t t = 0; t < num_targets; ++t)
+				{
+					populate_grid_maps(targets[t], newcomer_atom_types[t]);
 				}
 
-				// Create grid maps on the fly if necessary.
-				BOOST_ASSERT(atom_types_to_populate.empty());
-				const vector<size_t> ligand_atom_types = lig.get_atom_types();
-				for (const auto t : ligand_atom_types)
+				// Render the models of the newcomers in parallel into their own buffers, and save them in rank order.
+				cout << local_time() << "Rendering " << num_newcomers << " new hits" << endl;
+				vector<text_buffer> models(num_newcomers);
+				cnt.init(num_newcomers);
+				for (size_t i = 0; i < num_newcomers; ++i)
 				{
-					BOOST_ASSERT(t < XS_TYPE_SIZE);
-					array3d<fl>& grid_map = grid_maps[t];
-					if (grid_map.initialized()) continue; // The grid map of XScore atom type t has already been populated.
-					grid_map.resize(b.num_probes); // An exception may be thrown in case memory is exhausted.
-					atom_types_to_populate.push_back(t);  // The grid map of XScore atom type t has not been populated and should be populated now.
+					io.post([&,i]()
+					{
+						if (!newcomer_failures[i])
+						{
+							try
+							{
+								if (!write_hit_model(models[i], *newcomers[i], *newcomer_ligands[i])) models[i].clear();
+							}
+							catch (...)
+							{
+								newcomer_failures[i] = current_exception();
+								models[i].clear();
+							}
+						}
+						cnt.increment();
+					});
 				}
-				if (atom_types_to_populate.size())
+				cnt.wait();
+				for (size_t i = 0; i < num_newcomers; ++i)
 				{
-					cnt.init(num_gm_tasks);
-					for (size_t x = 0; x < num_gm_tasks; ++x)
+					// A model that failed to load or render is saved as an empty file, which marks the hit as rendered so that later folds do not retry it, and which phase 2 skips.
+					if (models[i].empty())
 					{
-						io.post([&,x]()
+						string reason;
+						if (newcomer_failures[i])
 						{
-							grid_map_task(grid_maps, atom_types_to_populate, x, sf, b, rec);
-							cnt.increment();
-						});
+							try
+							{
+								rethrow_exception(newcomer_failures[i]);
+							}
+							catch (const exception& e)
+							{
+								reason = string(": ") + e.what();
+							}
+							catch (...)
+							{
+							}
+						}
+						cerr << local_time() << "[warning] Dropped the model of ligand index " << newcomers[i]->index << " from hits.pdbqt.gz" << reason << endl;
+					}
+					boost::filesystem::ofstream model(lcl_job_path / (lexical_cast<string>(newcomers[i]->index) + ".pdbqt"));
+					models[i].flush(model);
+				}
+				{
+					boost::filesystem::ofstream hits_bin(lcl_job_path / "hits.bin.tmp", ios::binary);
+					for (const auto& s : hits)
+					{
+						write_summary(hits_bin, s);
 					}
-					cnt.wait();
-					atom_types_to_populate.clear();
 				}
+				rename(lcl_job_path / "hits.bin.tmp", lcl_job_path / "hits.bin");
 
-				// Apply conformation.
-				fl e, f;
-				change g(lig.num_active_torsions);
-				lig.evaluate(s.conf, sf, b, grid_maps, -99, e, f, g);
-				const auto r = lig.compose_result(e, f, s.conf);
-
-				// Write models to ligand stream.
-				foslig
-					<< "MODEL " << '\n'
-					<< "REMARK 911 ZINC ID: " << zincid << '\n'
-					<< "REMARK 912 ZINC PROPERTIES:"
-					<< setw(8) << zp.mwt
-					<< setw(8) << zp.lgp
-					<< setw(8) << zp.ads
-					<< setw(8) << zp.pds
-					<< setw(3) << zp.hbd
-					<< setw(3) << zp.hba
-					<< setw(3) << zp.psa
-					<< setw(3) << zp.chg
-					<< setw(3) << zp.nrb
-					<< '\n'
-					<< "REMARK 913 ZINC SMILES: " << smiles << '\n'
-					<< "REMARK 914 ZINC SUPPLIERS: " << supplier << '\n'
-					<< "REMARK 915 IDOCK ATOM COUNTS:"
-					<< setw(3) << xp.counts[0]
-					<< setw(3) << xp.counts[1]
-					<< setw(3) << xp.counts[2]
-					<< setw(3) << xp.counts[3]
-					<< setw(3) << xp.counts[4]
-					<< setw(3) << xp.counts[5]
-					<< setw(3) << xp.counts[6]
-					<< setw(3) << xp.counts[7]
-					<< setw(3) << xp.counts[8]
-					<< setw(3) << xp.counts[9]
-					<< setw(3) << xp.counts[10]
-					<< setw(3) << xp.counts[11]
-					<< setw(3) << xp.counts[12]
-					<< setw(3) << xp.counts[13]
-					<< '\n'
-					<< "REMARK 916 IDOCK ATOM COUNTS:"
-					<< setw(3) << xp.counts[14]
-					<< setw(3) << xp.counts[15]
-					<< setw(3) << xp.counts[16]
-					<< setw(3) << xp.counts[17]
-					<< '\n'
-					<< "REMARK 917 IDOCK FRAME COUNTS:"
-					<< setw(3) << xp.counts[18]
-					<< setw(3) << xp.counts[19]
-					<< '\n'
-					<< "REMARK 918 IDOCK PROPERTIES:" << setw(8) << xp.mwt << '\n'
-				;
-				lig.write_model(foslig, s, r, b, grid_maps);
-				foslig << "ENDMDL\n";
+				// Publish the running hits so that users can watch results arrive, and flag the job so that its page links them.
+				if (publish_partial_hits)
+				{
+					cout << local_time() << "Writing partial_hits.csv.gz of " << hits.size() << " ligands" << endl;
+					if (upload(rmt_job_path / "partial_hits.csv.gz", [&](ostream& fospar)
+					{
+						fospar << hits_csv_header;
+						text_buffer rows;
+						for (const auto& s : hits)
+						{
+							write_hit_row(rows, s);
+						}
+						rows.flush(fospar);
+					}))
+					{
+						conn.update(collection, BSON("_id" << _id), BSON("$set" << BSON("partial_hits" << true)));
+					}
+				}
 			}
+
+			// Increment the finished slice counter.
+			cout << local_time() << "Incrementing the finished slice counter" << endl;
+			BSONObj finis_obj;
+			conn.runCommand("istar", BSON("findandmodify" << "idock" << "query" << BSON("_id" << _id) << "update" << BSON("$inc" << BSON("finished" << 1)) << "fields" << finis_fields), finis_obj);
+			if (finis_obj["value"].Obj()["finished"].Int() + 1 < num_slices) continue;
 		}
 
-		// Write output files remotely via SSH SCP.
-		auto curl = curl_easy_init();
-//		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
-		curl_easy_setopt(curl, CURLOPT_SSH_AUTH_TYPES, CURLSSH_AUTH_PUBLICKEY);
-		curl_easy_setopt(curl, CURLOPT_SSH_PRIVATE_KEYFILE, private_keyfile.c_str());
-		curl_easy_setopt(curl, CURLOPT_SSH_PUBLIC_KEYFILE, public_keyfile.c_str());
-		curl_easy_setopt(curl, CURLOPT_UPLOAD, 1);
-		curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_from_stringstream);
-		cout << local_time() << "Writing hits.csv.gz" << endl;
-		curl_easy_setopt(curl, CURLOPT_URL, (rmt_job_path / "hits.csv.gz").c_str());
-		curl_easy_setopt(curl, CURLOPT_INFILESIZE, sslog.tellp());
-		curl_easy_setopt(curl, CURLOPT_READDATA, &sslog);
-		curl_easy_perform(curl);
-		cout << local_time() << "Writing hits.pdbqt.gz" << endl;
-		curl_easy_setopt(curl, CURLOPT_URL, (rmt_job_path / "hits.pdbqt.gz").c_str());
-		curl_easy_setopt(curl, CURLOPT_INFILESIZE, sslig.tellp());
-		curl_easy_setopt(curl, CURLOPT_READDATA, &sslig);
-		curl_easy_perform(curl);
-		curl_easy_cleanup(curl);
-
-		// Set completed time.
-		cout << local_time() << "Setting completed time" << endl;
-		const auto millis_since_epoch = duration_cast<chrono::milliseconds>(system_clock::now().time_since_epoch()).count();
-		conn.update(collection, BSON("_id" << _id), BSON("$set" << BSON("completed" << Date_t(millis_since_epoch))));
-
-		// Send a completion notification email.
-		const auto compt_cursor = conn.query(collection, QUERY("_id" << _id), 1, 0, &compt_fields);
-		const auto compt = compt_cursor->next();
-		const auto email = compt["email"].String();
-		cout << local_time() << "Sending an email to " << email << endl;
-		stringstream msg;
-		msg
-			<< "From: idock <noreply@cse.cuhk.edu.hk>\n"
-			<< "Subject: Your idock job has completed\n"
-			<< '\n' // empty line to divide headers from body, see RFC5322
-			<< "Description: " + compt["description"].String() + "\nCompounds selected to dock: " + lexical_cast<string>(num_ligands) + "\nSubmitted: " + to_simple_string(ptime(epoch, boost::posix_time::milliseconds(compt["submitted"].Date().millis))) + " UTC\nCompleted: " + to_simple_string(ptime(epoch, boost::posix_time::milliseconds(millis_since_epoch))) + " UTC\nCompounds successfully docked: " + lexical_cast<string>(num_summaries) + "\nHit compounds written to output: " + lexical_cast<string>(num_hits) + "\nResult: http://istar.cse.cuhk.edu.hk/idock/iview/?" + _id.str();
-		const auto recipients = curl_slist_append(NULL, email.c_str());
-		curl = curl_easy_init();
-		curl_easy_setopt(curl, CURLOPT_URL, "smtp://137.189.91.190");
-		curl_easy_setopt(curl, CURLOPT_MAIL_FROM, "noreply@cse.cuhk.edu.hk");
-		curl_easy_setopt(curl, CURLOPT_MAIL_RCPT, recipients);
-		curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_from_stringstream);
-		curl_easy_setopt(curl, CURLOPT_READDATA, &msg);
-		curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
-		curl_easy_perform(curl);
-		curl_easy_cleanup(curl);
-		curl_slist_free_all(recipients);
-
-		// Remove slice csv files.
-		if (summaries.size())
+		// Hand over phase 2 to the finalizer, so that this node can lease the next slice right away.
+		// Every step reads only local files and its own copies of the job variables, and can thus be retried.
+		// The job is marked as completed even if an output file could not be written, so that it does not remain pending forever.
+		cout << local_time() << "Queuing job " << _id << " for finalization" << endl;
+		const auto job = make_shared<job_outputs>();
+		const size_t num_targets = targets.size();
+		fin.post(_id.str(),
 		{
-			cout << local_time() << "Removing slice csv directory" << endl;
-			remove_all(lcl_job_path);
-		}
+			{ "write hits.csv.gz", [&, _id, rmt_job_path, lcl_job_path, job]()
+			{
+				// Merge the sorted slice result files.
+				cout << local_time() << "Merging slice result files of job " << _id << endl;
+				ptr_vector<boost::filesystem::ifstream> slice_bins;
+				vector<summary> heads; // Next summary of each slice.
+				heads.reserve(num_slices);
+				vector<size_t> heap; // Slices that have summaries left, arranged as a min-heap of their next summaries, which are ordered by energy and then index.
+				heap.reserve(num_slices);
+				const auto heap_cmp = [&](const size_t x, const size_t y)
+				{
+					return heads[y] < heads[x];
+				};
+				for (size_t s = 0; s < num_slices; ++s)
+				{
+					slice_bins.push_back(new boost::filesystem::ifstream(lcl_job_path / (lexical_cast<string>(s) + ".bin"), ios::binary));
+					heads.push_back(summary(0, 0, 0, conformation(0)));
+					if (read_summary(slice_bins.back(), heads.back())) heap.push_back(s);
+				}
+				make_heap(heap.begin(), heap.end(), heap_cmp);
+				job->num_summaries = 0;
+				summary s(0, 0, 0, conformation(0));
+
+				// Write results for successfully docked ligands remotely while they are being merged.
+				const auto ok = upload(rmt_job_path / "hits.csv.gz", [&](ostream& foslog)
+				{
+					foslog << hits_csv_header;
+					text_buffer rows(1 << 16);
+					for (; !heap.empty(); ++job->num_summaries)
+					{
+						// Take the best remaining summary, and refill the heap from its slice.
+						pop_heap(heap.begin(), heap.end(), heap_cmp);
+						const auto k = heap.back();
+						swap(s, heads[k]);
+						if (read_summary(slice_bins[k], heads[k]))
+						{
+							push_heap(heap.begin(), heap.end(), heap_cmp);
+						}
+						else
+						{
+							heap.pop_back();
+						}
+
+						// Write to log stream in batches of rows.
+						write_hit_row(rows, s);
+						if (rows.size() >= 1 << 16) rows.flush(foslog);
+					}
+					rows.flush(foslog);
+				});
+				cout << local_time() << "Merged " << job->num_summaries << " ligands of job " << _id << endl;
+				return ok;
+			}},
+			{ "write hits.pdbqt.gz", [&, rmt_job_path, lcl_job_path, job]()
+			{
+				job->num_hits = 0;
+				return upload(rmt_job_path / "hits.pdbqt.gz", [&](ostream& foslig)
+				{
+					// Concatenate the models of the running hits, which were rendered as their slices finished.
+					foslig << "REMARK 901 FILE VERSION: 1.0.0\n";
+					boost::filesystem::ifstream hits_bin(lcl_job_path / "hits.bin", ios::binary);
+					for (summary h(0, 0, 0, conformation(0)); read_summary(hits_bin, h);)
+					{
+						boost::filesystem::ifstream model(lcl_job_path / (lexical_cast<string>(h.index) + ".pdbqt"));
+						if (!model || model.peek() == std::char_traits<char>::eof()) continue; // The model is missing or failed to render.
+						foslig << model.rdbuf();
+						++job->num_hits;
+					}
+				});
+			}},
+			{ "write targets.csv.gz", [&, rmt_job_path, lcl_job_path, num_targets]()
+			{
+				// Concatenate the per-target results of the slices, which are in ascending order of ligand index.
+				if (num_targets == 1) return true;
+				return upload(rmt_job_path / "targets.csv.gz", [&](ostream& fostgt)
+				{
+					fostgt << "ZINC ID";
+					for (size_t t = 0; t < num_targets; ++t)
+					{
+						fostgt << ",idock score against target " << t << " (kcal/mol),RF-Score against target " << t << " (pKd)";
+					}
+					fostgt << '\n';
+					for (size_t s = 0; s < num_slices; ++s)
+					{
+						boost::filesystem::ifstream slice_csv(lcl_job_path / (lexical_cast<string>(s) + "_targets.csv"));
+						if (slice_csv.peek() != std::char_traits<char>::eof()) fostgt << slice_csv.rdbuf();
+					}
+				});
+			}},
+		},
+		{
+			{ "set completed time", [&, _id, job](const string& failure)
+			{
+				// Record the failure, if any, alongside the completed time, so that the job is reported as failed rather than left incomplete.
+				job->completed = duration_cast<chrono::milliseconds>(system_clock::now().time_since_epoch()).count();
+				fin_conn.update(collection, BSON("_id" << _id), BSON("$set" << (failure.empty() ? BSON("completed" << Date_t(job->completed)) : BSON("completed" << Date_t(job->completed) << "error" << failure))));
+				return fin_conn.getLastError().empty();
+			}},
+			{ "send a completion notification email", [&, _id, num_ligands, job](const string& failure)
+			{
+				const auto compt_cursor = fin_conn.query(collection, QUERY("_id" << _id), 1, 0, &compt_fields);
+				const auto compt = compt_cursor->next();
+				const auto email = compt["email"].String();
+				cout << local_time() << "Sending an email to " << email << endl;
+				stringstream msg;
+				msg
+					<< "From: idock <noreply@cse.cuhk.edu.hk>\n"
+					<< "Subject: Your idock job has " << (failure.empty() ? "completed" : "failed") << '\n'
+					<< '\n' // empty line to divide headers from body, see RFC5322
+					<< (failure.empty() ? "" : "Error: " + failure + "\n")
+					<< "Description: " + compt["description"].String() + "\nCompounds selected to dock: " + lexical_cast<string>(num_ligands) + "\nSubmitted: " + to_simple_string(ptime(epoch, boost::posix_time::milliseconds(compt["submitted"].Date().millis))) + " UTC\nCompleted: " + to_simple_string(ptime(epoch, boost::posix_time::milliseconds(job->completed))) + " UTC\nCompounds successfully docked: " + lexical_cast<string>(job->num_summaries) + "\nHit compounds written to output: " + lexical_cast<string>(job->num_hits) + "\nResult: http://istar.cse.cuhk.edu.hk/idock/iview/?" + _id.str();
+				const auto recipients = curl_slist_append(NULL, email.c_str());
+				const auto curl = curl_easy_init();
+				curl_easy_setopt(curl, CURLOPT_URL, "smtp://137.189.91.190");
+				curl_easy_setopt(curl, CURLOPT_MAIL_FROM, "noreply@cse.cuhk.edu.hk");
+				curl_easy_setopt(curl, CURLOPT_MAIL_RCPT, recipients);
+				curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_from_stringstream);
+				curl_easy_setopt(curl, CURLOPT_READDATA, &msg);
+				curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+				const auto rc = curl_easy_perform(curl);
+				curl_easy_cleanup(curl);
+				curl_slist_free_all(recipients);
+				return rc == CURLE_OK;
+			}},
+			{ "remove the slice result directory", [lcl_job_path, job](const string& failure)
+			{
+				// Keep the slice result files of a failed job or a job without results for inspection and for rerunning phase 2.
+				if (failure.empty() && job->num_summaries) remove_all(lcl_job_path);
+				return true;
+			}},
+		});
 
 		if (phase2only) break;
 	}
+	fin.finish();
 	curl_global_cleanup();
 }
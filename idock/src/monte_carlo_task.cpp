@@ -1,6 +1,6 @@
 #include "monte_carlo_task.hpp"
 
-void monte_carlo_task(ptr_vector<result>& results, const ligand& lig, const size_t seed, const array<fl, num_alphas>& alphas, const scoring_function& sf, const box& b, const vector<array3d<fl>>& grid_maps)
+size_t monte_carlo_task(result_container& results, const ligand& lig, const uint64_t key, const uint32_t chain, const array<fl, num_alphas>& alphas, const scoring_function& sf, const box& b, const vector<array3d<fl>>& grid_maps)
 {
 	// Define constants.
 	const size_t num_mc_iterations = 100 * lig.num_heavy_atoms; ///< The number of iterations correlates to the complexity of ligand.
@@ -11,28 +11,29 @@ void monte_carlo_task(ptr_vector<result>& results, const ligand& lig, const size
 	const fl required_square_error = static_cast<fl>(1 * lig.num_heavy_atoms); // Ligands with RMSD < 1.0 will be clustered into the same cluster.
 	const fl pi = static_cast<fl>(3.1415926535897932); ///< Pi.
 
-	// On Linux, the std namespace contains std::mt19937 and std::normal_distribution.
+	// On Linux, the std namespace contains std::normal_distribution.
 	// In order to avoid ambiguity, use the complete scope.
 	using boost::random::variate_generator;
 	using boost::random::uniform_real_distribution;
 	using boost::random::uniform_int_distribution;
 	using boost::random::normal_distribution;
-	mt19937eng eng(seed);
-	variate_generator<mt19937eng&, uniform_real_distribution<fl>> uniform_01_gen(eng, uniform_real_distribution<fl>(  0,  1));
-	variate_generator<mt19937eng&, uniform_real_distribution<fl>> uniform_11_gen(eng, uniform_real_distribution<fl>( -1,  1));
-	variate_generator<mt19937eng&, uniform_real_distribution<fl>> uniform_pi_gen(eng, uniform_real_distribution<fl>(-pi, pi));
-	variate_generator<mt19937eng&, uniform_real_distribution<fl>> uniform_box0_gen(eng, uniform_real_distribution<fl>(b.corner1[0], b.corner2[0]));
-	variate_generator<mt19937eng&, uniform_real_distribution<fl>> uniform_box1_gen(eng, uniform_real_distribution<fl>(b.corner1[1], b.corner2[1]));
-	variate_generator<mt19937eng&, uniform_real_distribution<fl>> uniform_box2_gen(eng, uniform_real_distribution<fl>(b.corner1[2], b.corner2[2]));
-	variate_generator<mt19937eng&, uniform_int_distribution<size_t>> uniform_entity_gen(eng, uniform_int_distribution<size_t>(0, num_entities - 1));
-	variate_generator<mt19937eng&, normal_distribution<fl>> normal_01_gen(eng, normal_distribution<fl>(0, 1));
+	philox_engine eng(key, chain);
+	variate_generator<philox_engine&, uniform_real_distribution<fl>> uniform_01_gen(eng, uniform_real_distribution<fl>(  0,  1));
+	variate_generator<philox_engine&, uniform_real_distribution<fl>> uniform_11_gen(eng, uniform_real_distribution<fl>( -1,  1));
+	variate_generator<philox_engine&, uniform_real_distribution<fl>> uniform_pi_gen(eng, uniform_real_distribution<fl>(-pi, pi));
+	variate_generator<philox_engine&, uniform_real_distribution<fl>> uniform_box0_gen(eng, uniform_real_distribution<fl>(b.corner1[0], b.corner2[0]));
+	variate_generator<philox_engine&, uniform_real_distribution<fl>> uniform_box1_gen(eng, uniform_real_distribution<fl>(b.corner1[1], b.corner2[1]));
+	variate_generator<philox_engine&, uniform_real_distribution<fl>> uniform_box2_gen(eng, uniform_real_distribution<fl>(b.corner1[2], b.corner2[2]));
+	variate_generator<philox_engine&, uniform_int_distribution<size_t>> uniform_entity_gen(eng, uniform_int_distribution<size_t>(0, num_entities - 1));
+	variate_generator<philox_engine&, normal_distribution<fl>> normal_01_gen(eng, normal_distribution<fl>(0, 1));
 
 	// Generate an initial random conformation c0, and evaluate it.
 	conformation c0(lig.num_active_torsions);
 	fl e0, f0;
 	change g0(lig.num_active_torsions);
+	size_t num_evaluations = 0;
 	bool valid_conformation = false;
-	for (size_t i = 0; (i < 1000) && (!valid_conformation); ++i)
+	for (size_t i = 0; (i < 1000) && (!valid_conformation); ++i, ++num_evaluations)
 	{
 		// Randomize conformation c0.
 		c0.position = vec3(uniform_box0_gen(), uniform_box1_gen(), uniform_box2_gen());
@@ -43,8 +44,9 @@ void monte_carlo_task(ptr_vector<result>& results, const ligand& lig, const size
 		}
 		valid_conformation = lig.evaluate(c0, sf, b, grid_maps, e_upper_bound, e0, f0, g0);
 	}
-	if (!valid_conformation) return;
+	if (!valid_conformation) return num_evaluations;
 	fl best_e = e0; // The best free energy so far.
+	vector<vec3> heavy_atoms(lig.num_heavy_atoms); // Heavy atom coordinates of accepted conformations, reused across iterations.
 
 	// Initialize necessary variables for BFGS.
 	conformation c1(lig.num_active_torsions), c2(lig.num_active_torsions); // c2 = c1 + ap.
@@ -96,6 +98,7 @@ void monte_carlo_task(ptr_vector<result>& results, const ligand& lig, const size
 				BOOST_ASSERT(c1.orientation.is_normalized());
 			}
 			++num_mutations;
+			++num_evaluations;
 		} while (!lig.evaluate(c1, sf, b, grid_maps, e_upper_bound, e1, f1, g1));
 
 		// Initialize the Hessian matrix to identity.
@@ -143,6 +146,7 @@ void monte_carlo_task(ptr_vector<result>& results, const ligand& lig, const size
 				// Evaluate c2, subject to Wolfe conditions http://en.wikipedia.org/wiki/Wolfe_conditions
 				// 1) Armijo rule ensures that the step length alpha decreases f sufficiently.
 				// 2) The curvature condition ensures that the slope has been reduced sufficiently.
+				++num_evaluations;
 				if (lig.evaluate(c2, sf, b, grid_maps, e1 + 0.0001 * alpha * pg1, e2, f2, g2))
 				{
 					pg2 = 0;
@@ -195,7 +199,8 @@ void monte_carlo_task(ptr_vector<result>& results, const ligand& lig, const size
 			// e1 will be saved if and only if it is even better than the best one.
 			if (e1 < best_e || results.size() < results.capacity())
 			{
-				add_to_result_container(results, lig.compose_result(e1, f1, c1), required_square_error);
+				lig.compose_heavy_atoms(c1, heavy_atoms);
+				results.add(c1, e1, f1, heavy_atoms, required_square_error);
 				if (e1 < best_e) best_e = e0;
 			}
 
@@ -204,4 +209,5 @@ void monte_carlo_task(ptr_vector<result>& results, const ligand& lig, const size
 			e0 = e1;
 		}
 	}
+	return num_evaluations;
 }
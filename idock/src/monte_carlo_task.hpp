@@ -4,23 +4,18 @@
 
 #include <boost/random.hpp>
 #include "ligand.hpp"
-
-// Choose the appropriate Mersenne Twister engine for random number generation on 32-bit or 64-bit platform.
-#if defined(__x86_64) || defined(__x86_64__) || defined(__amd64) || defined(__amd64__) || defined(_M_X64) || defined(_M_AMD64)
-typedef boost::random::mt19937_64 mt19937eng;
-#else
-typedef boost::random::mt19937 mt19937eng;
-#endif
+#include "philox.hpp"
 
 const size_t num_alphas = 5; ///< Number of alpha values for determining step size in BFGS
 
 /// Task for running Monte Carlo Simulated Annealing algorithm to find local minimums of the scoring function.
-/// A Monte Carlo task uses a seed to initialize its own random number generator.
+/// A Monte Carlo task draws its random numbers from the Philox stream of its chain number under a key, so that its results depend only on the key and the chain, not on thread scheduling.
 /// It starts from a random initial conformation,
 /// repeats a specified number of iterations,
 /// uses precalculated alpha values for line search during BFGS local search,
 /// clusters free energies and heavy atom coordinate vectors of the best conformations into results,
 /// and sorts the results in the ascending order of free energies.
-void monte_carlo_task(ptr_vector<result>& results, const ligand& lig, const size_t seed, const array<fl, num_alphas>& alphas, const scoring_function& sf, const box& b, const vector<array3d<fl>>& grid_maps);
+/// Returns the number of evaluations of the scoring function, which measures the work of the task.
+size_t monte_carlo_task(result_container& results, const ligand& lig, const uint64_t key, const uint32_t chain, const array<fl, num_alphas>& alphas, const scoring_function& sf, const box& b, const vector<array3d<fl>>& grid_maps);
 
 #endif
@@ -0,0 +1,92 @@
+#pragma once
+#ifndef IDOCK_PHILOX_HPP
+#define IDOCK_PHILOX_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+/// Represents a Philox4x32-10 counter-based random number engine, which satisfies the requirements of a uniform random bit generator.
+/// The n-th output of a stream is a pure function of its key, its stream number and n, so that streams need no seeding state and can be replayed independently of how they are scheduled.
+/// Blocks are generated Num_Blocks at a time in structure-of-arrays loops, which compilers vectorize.
+class philox_engine
+{
+public:
+	typedef uint64_t result_type;
+	static const size_t Num_Blocks = 16; ///< Number of 128-bit blocks generated per refill.
+
+	static constexpr result_type min()
+	{
+		return 0;
+	}
+
+	static constexpr result_type max()
+	{
+		return UINT64_MAX;
+	}
+
+	/// Constructs the engine of a stream, e.g. a Monte Carlo chain, under a key, e.g. of a job and a ligand.
+	explicit philox_engine(const uint64_t key, const uint32_t stream) : k0(static_cast<uint32_t>(key)), k1(static_cast<uint32_t>(key >> 32)), stream(stream), counter(0), next(Num_Blocks * 2)
+	{
+	}
+
+	/// Returns the next 64 random bits.
+	result_type operator()()
+	{
+		if (next == Num_Blocks * 2) refill();
+		return buf[next++];
+	}
+
+	/// Skips the next z outputs.
+	void discard(unsigned long long z)
+	{
+		for (; z; --z) (*this)();
+	}
+
+private:
+	/// Generates the next Num_Blocks blocks. The counter of a block is (block index, stream, 0).
+	void refill()
+	{
+		std::array<uint32_t, Num_Blocks> c0, c1, c2, c3;
+		for (size_t j = 0; j < Num_Blocks; ++j)
+		{
+			c0[j] = static_cast<uint32_t>(counter + j);
+			c1[j] = static_cast<uint32_t>((counter + j) >> 32);
+			c2[j] = stream;
+			c3[j] = 0;
+		}
+		uint32_t r0 = k0, r1 = k1;
+		for (size_t round = 0; round < 10; ++round)
+		{
+			for (size_t j = 0; j < Num_Blocks; ++j)
+			{
+				const uint64_t p0 = static_cast<uint64_t>(0xD2511F53) * c0[j];
+				const uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57) * c2[j];
+				const uint32_t n0 = static_cast<uint32_t>(p1 >> 32) ^ c1[j] ^ r0;
+				const uint32_t n2 = static_cast<uint32_t>(p0 >> 32) ^ c3[j] ^ r1;
+				c1[j] = static_cast<uint32_t>(p1);
+				c3[j] = static_cast<uint32_t>(p0);
+				c0[j] = n0;
+				c2[j] = n2;
+			}
+			r0 += 0x9E3779B9;
+			r1 += 0xBB67AE85;
+		}
+		for (size_t j = 0; j < Num_Blocks; ++j)
+		{
+			buf[j * 2    ] = static_cast<uint64_t>(c1[j]) << 32 | c0[j];
+			buf[j * 2 + 1] = static_cast<uint64_t>(c3[j]) << 32 | c2[j];
+		}
+		counter += Num_Blocks;
+		next = 0;
+	}
+
+	const uint32_t k0; ///< Low half of the key.
+	const uint32_t k1; ///< High half of the key.
+	const uint32_t stream; ///< Stream number.
+	uint64_t counter; ///< Index of the next block to generate.
+	size_t next; ///< Index of the next output in buf.
+	std::array<uint64_t, Num_Blocks * 2> buf; ///< Generated outputs.
+};
+
+#endif
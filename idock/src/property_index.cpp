@@ -0,0 +1,306 @@
+#include <cmath>
+#include <limits>
+#include <cstring>
+#include <stdexcept>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "property_index.hpp"
+
+using std::numeric_limits;
+using std::runtime_error;
+
+/// Converts the bounds of a filter to the types of the columns, such that comparing a column value with the converted bounds is equivalent to comparing it with the original bounds.
+/// Returns false if no ligand can satisfy the filter.
+static bool convert_bounds(const property_filter& pf, float* flb, float* fub, int16_t* ilb, int16_t* iub)
+{
+	const double dlbs[num_float_properties] = { pf.mwt_lb, pf.lgp_lb, pf.ads_lb, pf.pds_lb };
+	const double dubs[num_float_properties] = { pf.mwt_ub, pf.lgp_ub, pf.ads_ub, pf.pds_ub };
+	for (size_t p = 0; p < num_float_properties; ++p)
+	{
+		// Round the lower bound up and the upper bound down to the nearest float.
+		flb[p] = static_cast<float>(dlbs[p]);
+		if (flb[p] < dlbs[p]) flb[p] = nextafterf(flb[p],  numeric_limits<float>::infinity());
+		fub[p] = static_cast<float>(dubs[p]);
+		if (fub[p] > dubs[p]) fub[p] = nextafterf(fub[p], -numeric_limits<float>::infinity());
+		if (!(flb[p] <= fub[p])) return false;
+	}
+	const int lbs[num_int16_properties] = { pf.hbd_lb, pf.hba_lb, pf.psa_lb, pf.chg_lb, pf.nrb_lb };
+	const int ubs[num_int16_properties] = { pf.hbd_ub, pf.hba_ub, pf.psa_ub, pf.chg_ub, pf.nrb_ub };
+	for (size_t p = 0; p < num_int16_properties; ++p)
+	{
+		if (lbs[p] > ubs[p] || lbs[p] > numeric_limits<int16_t>::max() || ubs[p] < numeric_limits<int16_t>::min()) return false;
+		ilb[p] = static_cast<int16_t>(std::max<int>(lbs[p], numeric_limits<int16_t>::min()));
+		iub[p] = static_cast<int16_t>(std::min<int>(ubs[p], numeric_limits<int16_t>::max()));
+	}
+	return true;
+}
+
+/// Writes columns of a type followed by their zone maps and library-wide bounds, in the layout mapped by map_columns().
+template <typename T>
+static void write_columns(const path& p, const vector<T>* columns, const vector<T>* mins, const vector<T>* maxs, const T* lows, const T* highs, const size_t num_columns)
+{
+	boost::filesystem::ofstream ofs(p, std::ios::binary);
+	for (size_t c = 0; c < num_columns; ++c) ofs.write(reinterpret_cast<const char*>(columns[c].data()), sizeof(T) * columns[c].size());
+	for (size_t c = 0; c < num_columns; ++c) ofs.write(reinterpret_cast<const char*>(mins[c].data()), sizeof(T) * mins[c].size());
+	for (size_t c = 0; c < num_columns; ++c) ofs.write(reinterpret_cast<const char*>(maxs[c].data()), sizeof(T) * maxs[c].size());
+	ofs.write(reinterpret_cast<const char*>(lows), sizeof(T) * num_columns);
+	ofs.write(reinterpret_cast<const char*>(highs), sizeof(T) * num_columns);
+	if (!ofs) throw runtime_error("Failed to write property index " + p.string());
+}
+
+/// Maps a file written by write_columns(), and points the columns and zone maps into it.
+template <typename T>
+static void map_columns(mapped_array<T>& file, const path& p, const size_t num_blocks, const T** columns, const T** mins, const T** maxs, double* lows, double* highs, const size_t num_columns)
+{
+	if (!boost::filesystem::exists(p)) throw runtime_error("Property index " + p.string() + " is missing. Run bin/encode to create it");
+	file.open(p);
+	const size_t n = num_blocks * property_index::block_size;
+	if (file.size() != num_columns * (n + 2 * num_blocks + 2)) throw runtime_error("Property index " + p.string() + " is inconsistent with the library manifest");
+	const T* d = file.data();
+	for (size_t c = 0; c < num_columns; ++c, d += n) columns[c] = d;
+	for (size_t c = 0; c < num_columns; ++c, d += num_blocks) mins[c] = d;
+	for (size_t c = 0; c < num_columns; ++c, d += num_blocks) maxs[c] = d;
+	for (size_t c = 0; c < num_columns; ++c) lows[c] = *d++;
+	for (size_t c = 0; c < num_columns; ++c) highs[c] = *d++;
+}
+
+property_index::property_index(const string& prefix, const size_t num_ligands) : num_ligands(num_ligands), num_blocks((num_ligands + block_size - 1) / block_size)
+{
+	map_columns(float_file, prefix + "_pidx_float.bin", num_blocks, floats, float_mins, float_maxs, lows, highs, num_float_properties);
+	map_columns(int16_file, prefix + "_pidx_int16.bin", num_blocks, int16s, int16_mins, int16_maxs, lows + num_float_properties, highs + num_float_properties, num_int16_properties);
+}
+
+void property_index::write(const library& lib, const string& prefix)
+{
+	// Transpose records into columns. The padding of the last block is NaN, which fails any comparison.
+	const size_t num_ligands = lib.num_ligands;
+	const size_t num_blocks = (num_ligands + block_size - 1) / block_size;
+	const size_t n = num_blocks * block_size;
+	vector<float> floats[num_float_properties];
+	vector<int16_t> int16s[num_int16_properties];
+	for (auto& c : floats) c.resize(n, numeric_limits<float>::quiet_NaN());
+	for (auto& c : int16s) c.resize(n, 0);
+	for (size_t i = 0; i < num_ligands; ++i)
+	{
+		const auto zp = lib.zproperties[i];
+		floats[0][i] = zp.mwt;
+		floats[1][i] = zp.lgp;
+		floats[2][i] = zp.ads;
+		floats[3][i] = zp.pds;
+		int16s[0][i] = zp.hbd;
+		int16s[1][i] = zp.hba;
+		int16s[2][i] = zp.psa;
+		int16s[3][i] = zp.chg;
+		int16s[4][i] = zp.nrb;
+	}
+
+	// Compute zone maps. A float block containing NaN gets NaN bounds, so that it is neither skipped nor accepted as a whole.
+	vector<float> float_mins[num_float_properties], float_maxs[num_float_properties];
+	float float_lows[num_float_properties], float_highs[num_float_properties];
+	for (size_t p = 0; p < num_float_properties; ++p)
+	{
+		float_mins[p].resize(num_blocks);
+		float_maxs[p].resize(num_blocks);
+		float_lows[p] = numeric_limits<float>::infinity();
+		float_highs[p] = -numeric_limits<float>::infinity();
+		for (size_t k = 0; k < num_blocks; ++k)
+		{
+			float lo = numeric_limits<float>::infinity(), hi = -lo;
+			bool nan = false;
+			for (size_t i = k * block_size; i < (k + 1) * block_size; ++i)
+			{
+				const float v = floats[p][i];
+				if (v != v)
+				{
+					nan = true;
+					continue;
+				}
+				lo = std::min(lo, v);
+				hi = std::max(hi, v);
+			}
+			float_lows[p] = std::min(float_lows[p], lo);
+			float_highs[p] = std::max(float_highs[p], hi);
+			float_mins[p][k] = nan ? numeric_limits<float>::quiet_NaN() : lo;
+			float_maxs[p][k] = nan ? numeric_limits<float>::quiet_NaN() : hi;
+		}
+	}
+	vector<int16_t> int16_mins[num_int16_properties], int16_maxs[num_int16_properties];
+	int16_t int16_lows[num_int16_properties], int16_highs[num_int16_properties];
+	for (size_t p = 0; p < num_int16_properties; ++p)
+	{
+		int16_mins[p].resize(num_blocks);
+		int16_maxs[p].resize(num_blocks);
+		int16_lows[p] = numeric_limits<int16_t>::max();
+		int16_highs[p] = numeric_limits<int16_t>::min();
+		for (size_t k = 0; k < num_blocks; ++k)
+		{
+			const auto beg = int16s[p].begin() + k * block_size;
+			const auto end = std::min(beg + block_size, int16s[p].begin() + num_ligands);
+			const auto mm = minmax_element(beg, end);
+			int16_mins[p][k] = *mm.first;
+			int16_maxs[p][k] = *mm.second;
+			int16_lows[p] = std::min(int16_lows[p], *mm.first);
+			int16_highs[p] = std::max(int16_highs[p], *mm.second);
+		}
+	}
+
+	write_columns(prefix + "_pidx_float.bin", floats, float_mins, float_maxs, float_lows, float_highs, num_float_properties);
+	write_columns(prefix + "_pidx_int16.bin", int16s, int16_mins, int16_maxs, int16_lows, int16_highs, num_int16_properties);
+}
+
+size_t property_index::filter_block(const size_t k, const float* flb, const float* fub, const int16_t* ilb, const int16_t* iub, uint8_t* bits) const
+{
+	// Skip the block if any property lies entirely outside its bounds, or accept the block if all properties lie entirely inside their bounds.
+	bool inside = true;
+	for (size_t p = 0; p < num_float_properties; ++p)
+	{
+		if (float_maxs[p][k] < flb[p] || fub[p] < float_mins[p][k])
+		{
+			memset(bits, 0, block_size >> 3);
+			return 0;
+		}
+		inside = inside && flb[p] <= float_mins[p][k] && float_maxs[p][k] <= fub[p];
+	}
+	for (size_t p = 0; p < num_int16_properties; ++p)
+	{
+		if (int16_maxs[p][k] < ilb[p] || iub[p] < int16_mins[p][k])
+		{
+			memset(bits, 0, block_size >> 3);
+			return 0;
+		}
+		inside = inside && ilb[p] <= int16_mins[p][k] && int16_maxs[p][k] <= iub[p];
+	}
+	if (inside)
+	{
+		memset(bits, 0xff, block_size >> 3);
+		return block_size;
+	}
+
+	// Evaluate the filter 8 ligands at a time.
+	const size_t o = k * block_size;
+	size_t n = 0;
+#ifdef __SSE2__
+	__m128 flbs[num_float_properties], fubs[num_float_properties];
+	__m128i ilbs[num_int16_properties], iubs[num_int16_properties];
+	for (size_t p = 0; p < num_float_properties; ++p)
+	{
+		flbs[p] = _mm_set1_ps(flb[p]);
+		fubs[p] = _mm_set1_ps(fub[p]);
+	}
+	for (size_t p = 0; p < num_int16_properties; ++p)
+	{
+		ilbs[p] = _mm_set1_epi16(ilb[p]);
+		iubs[p] = _mm_set1_epi16(iub[p]);
+	}
+#endif
+	for (size_t i = 0; i < block_size; i += 8)
+	{
+		unsigned m = 0xff;
+#ifdef __SSE2__
+		for (size_t p = 0; p < num_float_properties; ++p)
+		{
+			const float* const c = floats[p] + o + i;
+			const __m128 v0 = _mm_loadu_ps(c);
+			const __m128 v1 = _mm_loadu_ps(c + 4);
+			m &= _mm_movemask_ps(_mm_and_ps(_mm_cmple_ps(flbs[p], v0), _mm_cmple_ps(v0, fubs[p])))
+			  | _mm_movemask_ps(_mm_and_ps(_mm_cmple_ps(flbs[p], v1), _mm_cmple_ps(v1, fubs[p]))) << 4;
+		}
+		for (size_t p = 0; p < num_int16_properties; ++p)
+		{
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(int16s[p] + o + i));
+			const __m128i out = _mm_or_si128(_mm_cmplt_epi16(v, ilbs[p]), _mm_cmpgt_epi16(v, iubs[p]));
+			m &= ~_mm_movemask_epi8(_mm_packs_epi16(out, _mm_setzero_si128()));
+		}
+		m &= 0xff;
+#else
+		for (size_t j = 0; j < 8; ++j)
+		{
+			bool s = true;
+			for (size_t p = 0; p < num_float_properties; ++p)
+			{
+				const float v = floats[p][o + i + j];
+				s = s && flb[p] <= v && v <= fub[p];
+			}
+			for (size_t p = 0; p < num_int16_properties; ++p)
+			{
+				const int16_t v = int16s[p][o + i + j];
+				s = s && ilb[p] <= v && v <= iub[p];
+			}
+			if (!s) m &= ~(1u << j);
+		}
+#endif
+		bits[i >> 3] = static_cast<uint8_t>(m);
+		n += __builtin_popcount(m);
+	}
+	return n;
+}
+
+size_t property_index::filter(const property_filter& pf, vector<uint8_t>& bitmap) const
+{
+	bitmap.assign(num_blocks * (block_size >> 3), 0);
+	float flb[num_float_properties], fub[num_float_properties];
+	int16_t ilb[num_int16_properties], iub[num_int16_properties];
+	if (!convert_bounds(pf, flb, fub, ilb, iub)) return 0;
+	size_t n = 0;
+	for (size_t k = 0; k < num_blocks; ++k)
+	{
+		n += filter_block(k, flb, fub, ilb, iub, bitmap.data() + k * (block_size >> 3));
+	}
+	return n;
+}
+
+vector<size_t> property_index::select(const property_filter& pf, const size_t beg, const size_t end) const
+{
+	BOOST_ASSERT(beg <= end);
+	BOOST_ASSERT(end <= num_ligands);
+	vector<size_t> indexes;
+	float flb[num_float_properties], fub[num_float_properties];
+	int16_t ilb[num_int16_properties], iub[num_int16_properties];
+	if (!convert_bounds(pf, flb, fub, ilb, iub)) return indexes;
+	uint8_t bits[block_size >> 3];
+	for (size_t k = beg / block_size; k * block_size < end; ++k)
+	{
+		if (!filter_block(k, flb, fub, ilb, iub, bits)) continue;
+		const size_t o = k * block_size;
+		for (size_t i = std::max(o, beg); i < std::min(o + block_size, end); ++i)
+		{
+			if (bits[(i - o) >> 3] & (1 << ((i - o) & 7))) indexes.push_back(i);
+		}
+	}
+	return indexes;
+}
+
+vector<size_t> property_index::histogram(const vector<uint8_t>& bitmap, const size_t property, const size_t num_bins) const
+{
+	BOOST_ASSERT(property < num_properties);
+	BOOST_ASSERT(num_bins);
+	vector<size_t> bins(num_bins, 0);
+	const double lo = lows[property];
+	const double width = (highs[property] - lo) / num_bins;
+	for (size_t i = 0; i < num_ligands; ++i)
+	{
+		if (!(bitmap[i >> 3] & (1 << (i & 7)))) continue;
+		const double v = value(property, i);
+		const size_t b = width > 0 ? static_cast<size_t>((v - lo) / width) : 0;
+		++bins[std::min(b, num_bins - 1)];
+	}
+	return bins;
+}
+
+double property_index::min(const size_t property) const
+{
+	return lows[property];
+}
+
+double property_index::max(const size_t property) const
+{
+	return highs[property];
+}
+
+double property_index::value(const size_t property, const size_t index) const
+{
+	return property < num_float_properties ? floats[property][index] : int16s[property - num_float_properties][index];
+}
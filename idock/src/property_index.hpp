@@ -0,0 +1,70 @@
+#pragma once
+#ifndef IDOCK_PROPERTY_INDEX_HPP
+#define IDOCK_PROPERTY_INDEX_HPP
+
+#include "library.hpp"
+
+/// Represents inclusive bounds of ZINC properties that a ligand must satisfy in order to be selected.
+struct property_filter
+{
+	double mwt_lb, mwt_ub, lgp_lb, lgp_ub, ads_lb, ads_ub, pds_lb, pds_ub;
+	int hbd_lb, hbd_ub, hba_lb, hba_ub, psa_lb, psa_ub, chg_lb, chg_ub, nrb_lb, nrb_ub;
+};
+
+const size_t num_float_properties = 4; ///< Number of floating point ZINC properties, i.e. mwt, lgp, ads, pds.
+const size_t num_int16_properties = 5; ///< Number of integral ZINC properties, i.e. hbd, hba, psa, chg, nrb.
+const size_t num_properties = num_float_properties + num_int16_properties; ///< Number of ZINC properties.
+const string property_names[num_properties] = { "mwt", "lgp", "ads", "pds", "hbd", "hba", "psa", "chg", "nrb" }; ///< ZINC property names in column order.
+
+/// Represents ZINC properties of a ligand library stored column by column, with per-block minimum and maximum values as zone maps.
+/// Range filtering evaluates 8 ligands at a time with SSE2, and skips or accepts a whole block whenever its zone map lies outside or inside the bounds.
+/// The columns and zone maps are precomputed by bin/encode into two files, e.g. 16_pidx_float.bin and 16_pidx_int16.bin, which are memory-mapped.
+/// Each file holds the columns of one type, padded to whole blocks, followed by their minimum zone maps, their maximum zone maps, their library-wide minimums and their library-wide maximums.
+class property_index
+{
+public:
+	static const size_t block_size = 4096; ///< Number of ligands per block.
+
+	/// Maps the property index files prefixed with the given name.
+	/// @exception runtime_error Thrown when the files are missing or inconsistent with the number of ligands, e.g. when the library has not been encoded by bin/encode.
+	explicit property_index(const string& prefix, const size_t num_ligands);
+
+	/// Transposes the ZINC properties of a library into columns, computes their zone maps, and writes them to the property index files prefixed with the given name.
+	static void write(const library& lib, const string& prefix);
+
+	/// Evaluates a filter over all the ligands, and sets one bit per selected ligand in the bitmap. Returns the number of selected ligands.
+	size_t filter(const property_filter& pf, vector<uint8_t>& bitmap) const;
+
+	/// Returns the indexes of the ligands in [beg, end) that satisfy a filter, in ascending order.
+	vector<size_t> select(const property_filter& pf, const size_t beg, const size_t end) const;
+
+	/// Counts the selected ligands of a bitmap in each of the given number of equal-width bins spanning the library-wide range of a property.
+	vector<size_t> histogram(const vector<uint8_t>& bitmap, const size_t property, const size_t num_bins) const;
+
+	/// Returns the library-wide minimum of a property.
+	double min(const size_t property) const;
+
+	/// Returns the library-wide maximum of a property.
+	double max(const size_t property) const;
+
+	const size_t num_ligands; ///< Number of ligands.
+	const size_t num_blocks; ///< Number of blocks, the last of which is padded with values that never pass a filter.
+private:
+	/// Evaluates a filter over the ligands of block k, and writes block_size / 8 bytes of selection bitmap. Returns the number of selected ligands.
+	size_t filter_block(const size_t k, const float* flb, const float* fub, const int16_t* ilb, const int16_t* iub, uint8_t* bits) const;
+
+	/// Returns the value of a property of a ligand.
+	double value(const size_t property, const size_t index) const;
+
+	mapped_array<float> float_file; ///< Mapped file of floating point properties.
+	mapped_array<int16_t> int16_file; ///< Mapped file of integral properties.
+	const float* floats[num_float_properties]; ///< Floating point property columns.
+	const int16_t* int16s[num_int16_properties]; ///< Integral property columns.
+	const float* float_mins[num_float_properties]; ///< Minimum zone maps of floating point properties.
+	const float* float_maxs[num_float_properties]; ///< Maximum zone maps of floating point properties.
+	const int16_t* int16_mins[num_int16_properties]; ///< Minimum zone maps of integral properties.
+	const int16_t* int16_maxs[num_int16_properties]; ///< Maximum zone maps of integral properties.
+	double lows[num_properties], highs[num_properties]; ///< Library-wide minimum and maximum values of properties.
+};
+
+#endif
@@ -0,0 +1,38 @@
+#include <iostream>
+#include <boost/lexical_cast.hpp>
+#include "property_index.hpp"
+
+using namespace std;
+
+int main(int argc, char* argv[])
+{
+	// Check the required number of command line arguments.
+	if (argc < 2)
+	{
+		cout << "query 16 [num_bins]" << endl
+		     << "Reads filters of 18 bounds per line from standard input in the order of mwt_lb mwt_ub lgp_lb lgp_ub ads_lb ads_ub pds_lb pds_ub hbd_lb hbd_ub hba_lb hba_ub psa_lb psa_ub chg_lb chg_ub nrb_lb nrb_ub," << endl
+		     << "and writes per line the number of selected ligands, followed by the histograms of the selected ligands over num_bins bins for every property if num_bins is given." << endl;
+		return 0;
+	}
+	const size_t num_bins = argc > 2 ? lexical_cast<size_t>(argv[2]) : 0;
+
+	// Map the columnar property index, and serve filters until the end of input.
+	const library lib(argv[1]);
+	const property_index idx(argv[1], lib.num_ligands);
+	property_filter pf;
+	vector<uint8_t> bitmap;
+	while (cin >> pf.mwt_lb >> pf.mwt_ub >> pf.lgp_lb >> pf.lgp_ub >> pf.ads_lb >> pf.ads_ub >> pf.pds_lb >> pf.pds_ub >> pf.hbd_lb >> pf.hbd_ub >> pf.hba_lb >> pf.hba_ub >> pf.psa_lb >> pf.psa_ub >> pf.chg_lb >> pf.chg_ub >> pf.nrb_lb >> pf.nrb_ub)
+	{
+		cout << idx.filter(pf, bitmap);
+		for (size_t p = 0; num_bins && p < num_properties; ++p)
+		{
+			cout << ' ' << property_names[p] << ':';
+			const auto bins = idx.histogram(bitmap, p, num_bins);
+			for (size_t b = 0; b < num_bins; ++b)
+			{
+				cout << (b ? "," : "") << bins[b];
+			}
+		}
+		cout << endl;
+	}
+}
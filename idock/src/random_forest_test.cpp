@@ -1,3 +1,7 @@
+#include <cstdio>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
 #include "random_forest_test.hpp"
 
 void node::load(ifstream& ifs)
@@ -59,3 +63,143 @@ float forest::operator()(const vector<float>& x) const
 	}
 	return y /= size();
 }
+
+flat_forest::flat_forest(const forest& f)
+{
+	size_t num_nodes = 0;
+	for (const tree& t : f)
+	{
+		num_nodes += t.size();
+	}
+	const size_t header_size = sizeof(uint32_t) * (2 + f.size());
+	buf.resize(header_size + sizeof(flat_node) * num_nodes);
+	uint32_t* const header = reinterpret_cast<uint32_t*>(buf.data());
+	flat_node* const dst = reinterpret_cast<flat_node*>(buf.data() + header_size);
+
+	// Lay out the nodes of every tree breadth first, so that the two children of a node are adjacent.
+	uint32_t base = 0;
+	vector<size_t> order; // Original indexes of the nodes of the current tree in breadth-first order.
+	for (size_t t = 0; t < f.size(); ++t)
+	{
+		const tree& src = f[t];
+		order.assign(1, 0);
+		for (size_t i = 0; i < order.size(); ++i)
+		{
+			const node& n = src[order[i]];
+			flat_node& d = dst[base + i];
+			d.y = n.y;
+			d.reserved = 0;
+			if (n.children[0])
+			{
+				d.val = n.val;
+				d.var = static_cast<uint16_t>(n.var);
+				d.left = static_cast<uint32_t>(base + order.size());
+				order.push_back(n.children[0]);
+				order.push_back(n.children[1]);
+			}
+			else
+			{
+				d.val = numeric_limits<float>::infinity();
+				d.var = 0;
+				d.left = base + static_cast<uint32_t>(i);
+			}
+		}
+		header[2 + t] = base;
+		base += static_cast<uint32_t>(order.size());
+	}
+	header[0] = static_cast<uint32_t>(f.size());
+	header[1] = base;
+	buf.resize(header_size + sizeof(flat_node) * base); // Nodes unreachable from their roots are dropped.
+	attach(buf.data());
+}
+
+flat_forest::flat_forest(const string& path) : file(path)
+{
+	const size_t size = file.size();
+	const uint32_t* const header = reinterpret_cast<const uint32_t*>(file.data());
+	if (size < sizeof(uint32_t) * 2 || size != sizeof(uint32_t) * (2 + header[0]) + sizeof(flat_node) * header[1])
+	{
+		throw runtime_error("Flattened random forest " + path + " is corrupted");
+	}
+	attach(file.data());
+}
+
+void flat_forest::attach(const char* data)
+{
+	const uint32_t* const header = reinterpret_cast<const uint32_t*>(data);
+	this->data = data;
+	num_trees = header[0];
+	roots = header + 2;
+	nodes = reinterpret_cast<const flat_node*>(roots + num_trees);
+	size = reinterpret_cast<const char*>(nodes + header[1]) - data;
+}
+
+void flat_forest::save(const string& path) const
+{
+	const string tmp = path + ".tmp";
+	{
+		ofstream ofs(tmp, ios::binary);
+		ofs.write(data, size);
+	}
+	rename(tmp.c_str(), path.c_str());
+}
+
+float flat_forest::operator()(const float* x) const
+{
+	float y = 0;
+	for (uint32_t t = 0; t < num_trees; ++t)
+	{
+		uint32_t k = roots[t];
+		for (const flat_node* n; (n = nodes + k)->left != k;)
+		{
+			k = n->left + (x[n->var] > n->val);
+		}
+		y += nodes[k].y;
+	}
+	return y /= num_trees;
+}
+
+void flat_forest::operator()(const float* xs, const size_t stride, const size_t n, float* ys) const
+{
+	const size_t w = 8; // Number of interleaved samples.
+	fill(ys, ys + n, 0.0f);
+	for (uint32_t t = 0; t < num_trees; ++t)
+	{
+		const uint32_t root = roots[t];
+		size_t i = 0;
+		for (; i + w <= n; i += w)
+		{
+			uint32_t k[w];
+			fill(k, k + w, root);
+			for (bool moved = true; moved;)
+			{
+				moved = false;
+				for (size_t j = 0; j < w; ++j)
+				{
+					const flat_node& nd = nodes[k[j]];
+					const uint32_t next = nd.left + (xs[(i + j) * stride + nd.var] > nd.val);
+					moved |= next != k[j];
+					k[j] = next;
+				}
+			}
+			for (size_t j = 0; j < w; ++j)
+			{
+				ys[i + j] += nodes[k[j]].y;
+			}
+		}
+		for (; i < n; ++i)
+		{
+			const float* const x = xs + i * stride;
+			uint32_t k = root;
+			for (const flat_node* nd; (nd = nodes + k)->left != k;)
+			{
+				k = nd->left + (x[nd->var] > nd->val);
+			}
+			ys[i] += nodes[k].y;
+		}
+	}
+	for (size_t i = 0; i < n; ++i)
+	{
+		ys[i] /= num_trees;
+	}
+}
@@ -5,6 +5,8 @@
 #include <vector>
 #include <array>
 #include <fstream>
+#include <cstdint>
+#include <boost/iostreams/device/mapped_file.hpp>
 using namespace std;
 
 class node
@@ -42,4 +44,50 @@ public:
 	float operator()(const vector<float>& x) const;
 };
 
+/// Represents a node of a flat_forest in 16 bytes.
+/// A leaf points to itself and never takes its right branch, so that a sample rests at its leaf while the other samples of a batch keep descending.
+struct flat_node
+{
+	float val; ///< Value used for node split, or +infinity for a leaf
+	uint32_t left; ///< Index of the left child in the forest, the right child being next to it, or the index of the leaf itself
+	uint16_t var; ///< Variable used for node split, or 0 for a leaf
+	uint16_t reserved; ///< Padding, always 0
+	float y; ///< Average of y values of node samples
+};
+static_assert(sizeof(flat_node) == 16, "flat_node must occupy 16 bytes");
+
+/// Represents a read-only forest whose nodes are stored contiguously, tree after tree, each tree in breadth-first order.
+/// The in-memory layout equals the file layout, i.e. the number of trees and of nodes as uint32_t, the root of every tree as uint32_t, and the nodes, so that a saved forest can be memory-mapped instead of parsed.
+class flat_forest
+{
+public:
+	/// Flattens a forest.
+	explicit flat_forest(const forest& f);
+
+	/// Maps a flattened forest saved by save().
+	explicit flat_forest(const string& path);
+
+	/// Saves the flattened forest to a file, which is written under a temporary name and then renamed, so that concurrent readers never map a partial file.
+	void save(const string& path) const;
+
+	/// Predicts the y value of a sample x, identical to forest::operator().
+	float operator()(const float* x) const;
+
+	/// Predicts the y values of n samples whose features are stride floats apart.
+	/// Every tree is traversed by all the samples before the next tree, interleaving 8 samples at a time until all of them rest at leaves, so that the tree stays in cache and the loads of independent samples overlap.
+	void operator()(const float* xs, const size_t stride, const size_t n, float* ys) const;
+
+private:
+	/// Points the accessors into the given data of the file layout.
+	void attach(const char* data);
+
+	vector<char> buf; ///< Flattened forest built in memory.
+	boost::iostreams::mapped_file_source file; ///< Flattened forest mapped from a file.
+	const char* data; ///< Flattened forest in the file layout.
+	size_t size; ///< Number of bytes of the flattened forest.
+	uint32_t num_trees; ///< Number of trees.
+	const uint32_t* roots; ///< Root of every tree.
+	const flat_node* nodes; ///< Nodes of all the trees.
+};
+
 #endif
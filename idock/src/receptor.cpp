@@ -1,12 +1,13 @@
-#include <boost/filesystem/fstream.hpp>
-#include <boost/algorithm/string.hpp>
 #include "parsing_error.hpp"
 #include "scoring_function.hpp"
 #include "receptor.hpp"
 
-using std::istringstream;
+const fl receptor::RF_Cutoff = static_cast<fl>(12);
+const fl receptor::RF_Cutoff_Sqr = RF_Cutoff * RF_Cutoff;
+const fl receptor::RF_Cell_Size = static_cast<fl>(4);
+const fl receptor::RF_Cell_Size_Inverse = 1 / RF_Cell_Size;
 
-receptor::receptor(istream& is, const box& b) : partitions(b.num_partitions)
+receptor::receptor(const string_ref pdbqt, const box& b) : partitions(b.num_partitions)
 {
 	// Initialize necessary variables for constructing a receptor.
 	atoms.reserve(5000); // A receptor typically consists of <= 5,000 atoms.
@@ -16,27 +17,24 @@ receptor::receptor(istream& is, const box& b) : partitions(b.num_partitions)
 	vector<size_t> residues;
 	residues.reserve(1000); // A receptor typically consists of <= 1,000 residues, including metal ions and water molecules if any.
 	size_t num_lines = 0; // Used to track line number for reporting parsing errors, if any.
-	string line;
-	line.reserve(79); // According to PDBQT specification, the last item AutoDock atom type locates at 1-based [78, 79].
+	string_ref buf = pdbqt; // Remaining part of the buffer to parse.
+	string_ref line; // Current line, which references the buffer without copying.
 
 	// Parse ATOM/HETATM.
-	while (getline(is, line))
+	while (getline(buf, line))
 	{
 		++num_lines;
 		if (starts_with(line, "ATOM") || starts_with(line, "HETATM"))
 		{
 			// Parse and validate AutoDock4 atom type.
-			const string ad_type_string = line.substr(77, isspace(line[78]) ? 1 : 2);
-			const size_t ad = parse_ad_type_string(ad_type_string);
+			const size_t ad = parse_ad_type_string(ad_type_field(line));
 			if (ad == AD_TYPE_SIZE) continue;
 
 			// Skip non-polar hydrogens.
 			if (ad == AD_TYPE_H) continue;
 
 			// Parse the Cartesian coordinate.
-			string name = line.substr(12, 4);
-			boost::algorithm::trim(name);
-			const atom a(line.substr(21, 1) + ':' + line.substr(17, 3) + right_cast<string>(line, 23, 26) + ':' + name, vec3(right_cast<fl>(line, 31, 38), right_cast<fl>(line, 39, 46), right_cast<fl>(line, 47, 54)), ad);
+			const atom a(vec3(right_cast<fl>(line, 31, 38), right_cast<fl>(line, 39, 46), right_cast<fl>(line, 47, 54)), ad);
 
 			// For a polar hydrogen, the bonded hetero atom must be a hydrogen bond donor.
 			if (ad == AD_TYPE_HD)
@@ -135,4 +133,51 @@ receptor::receptor(istream& is, const box& b) : partitions(b.num_partitions)
 			}
 		}
 	}
+
+	// Bin the atoms with an RF-Score type into a cell list, so that the RF-Score features of a pose only visit nearby atoms.
+	vec3 rf_corner2;
+	size_t num_rf_atoms = 0;
+	for (const atom& a : atoms)
+	{
+		if (a.rf == RF_TYPE_SIZE) continue;
+		for (size_t i = 0; i < 3; ++i)
+		{
+			if (!num_rf_atoms || a.coordinate[i] < rf_corner1[i]) rf_corner1[i] = a.coordinate[i];
+			if (!num_rf_atoms || a.coordinate[i] > rf_corner2[i]) rf_corner2[i] = a.coordinate[i];
+		}
+		++num_rf_atoms;
+	}
+	if (!num_rf_atoms) return;
+	for (size_t i = 0; i < 3; ++i)
+	{
+		num_rf_cells[i] = static_cast<size_t>((rf_corner2[i] - rf_corner1[i]) * RF_Cell_Size_Inverse) + 1;
+	}
+	const auto cell_of = [&](const vec3& coordinate)
+	{
+		array<size_t, 3> index;
+		for (size_t i = 0; i < 3; ++i)
+		{
+			index[i] = min(num_rf_cells[i] - 1, static_cast<size_t>((coordinate[i] - rf_corner1[i]) * RF_Cell_Size_Inverse));
+		}
+		return num_rf_cells[2] * (num_rf_cells[1] * index[0] + index[1]) + index[2];
+	};
+
+	// Counting sort the atoms by cell, preserving their order within each cell.
+	rf_cell_offsets.assign(num_rf_cells[0] * num_rf_cells[1] * num_rf_cells[2] + 1, 0);
+	for (const atom& a : atoms)
+	{
+		if (a.rf == RF_TYPE_SIZE) continue;
+		++rf_cell_offsets[cell_of(a.coordinate) + 1];
+	}
+	for (size_t c = 1; c < rf_cell_offsets.size(); ++c)
+	{
+		rf_cell_offsets[c] += rf_cell_offsets[c - 1];
+	}
+	vector<size_t> next(rf_cell_offsets.begin(), rf_cell_offsets.end() - 1);
+	rf_atoms.resize(num_rf_atoms, atoms.front());
+	for (const atom& a : atoms)
+	{
+		if (a.rf == RF_TYPE_SIZE) continue;
+		rf_atoms[next[cell_of(a.coordinate)]++] = a;
+	}
 }
@@ -2,6 +2,7 @@
 #ifndef IDOCK_RECEPTOR_HPP
 #define IDOCK_RECEPTOR_HPP
 
+#include <cmath>
 #include "atom.hpp"
 #include "array3d.hpp"
 #include "box.hpp"
@@ -10,15 +11,70 @@
 class receptor
 {
 public:
+	static const fl RF_Cutoff; ///< Cutoff of RF-Score features.
+	static const fl RF_Cutoff_Sqr; ///< Square of RF_Cutoff.
+	static const fl RF_Cell_Size; ///< 1D size of the cells of RF-Score typed atoms.
+	static const fl RF_Cell_Size_Inverse; ///< 1 / RF_Cell_Size.
+
 	/// Default constructor.
 	receptor() {}
 	
-	/// Constructs a receptor by parsing a receptor string in pdbqt format.
+	/// Constructs a receptor by parsing a receptor buffer in pdbqt format in place.
 	/// @exception parsing_error Thrown when an atom type is not recognized.
-	explicit receptor(istream& is, const box& b);
+	explicit receptor(const string_ref pdbqt, const box& b);
 
 	vector<atom> atoms; ///< Receptor atoms.
 	array3d<vector<size_t>> partitions; ///< Heavy atoms in partitions.
+	vector<atom> rf_atoms; ///< Atoms with an RF-Score type, ordered by cell and then by index.
+	vector<size_t> rf_cell_offsets; ///< Offset into rf_atoms of the first atom of each cell, followed by the number of rf_atoms.
+	vec3 rf_corner1; ///< Cell list boundary corner with smallest values of all the 3 dimensions.
+	array<size_t, 3> num_rf_cells; ///< Number of cells.
+
+	/// Calls f(a, dist_sqr) for every atom a with an RF-Score type whose square distance to a coordinate is less than RF_Cutoff_Sqr.
+	/// Only the cells overlapping the cutoff sphere are visited, so the cost depends on the local atom density rather than on the receptor size.
+	template<typename F>
+	void for_each_rf_neighbor(const vec3& coordinate, F f) const
+	{
+		if (rf_atoms.empty()) return;
+
+		// Determine the range of cells within reach, and the square distances from the coordinate to their slabs.
+		const size_t reach = static_cast<size_t>(ceil(RF_Cutoff * RF_Cell_Size_Inverse));
+		array<size_t, 3> beg, end;
+		array<array<fl, 7>, 3> gap_sqr;
+		BOOST_ASSERT(2 * reach + 1 <= gap_sqr[0].size());
+		for (size_t i = 0; i < 3; ++i)
+		{
+			const fl c = floor((coordinate[i] - rf_corner1[i]) * RF_Cell_Size_Inverse);
+			if (c + reach < 0 || c >= num_rf_cells[i] + reach) return;
+			beg[i] = c < reach ? 0 : static_cast<size_t>(c) - reach;
+			end[i] = min(num_rf_cells[i], static_cast<size_t>(c + reach + 1));
+			for (size_t k = beg[i]; k < end[i]; ++k)
+			{
+				const fl lo = rf_corner1[i] + RF_Cell_Size * k;
+				const fl d = coordinate[i] < lo ? lo - coordinate[i] : (coordinate[i] > lo + RF_Cell_Size ? coordinate[i] - lo - RF_Cell_Size : 0);
+				gap_sqr[i][k - beg[i]] = d * d;
+			}
+		}
+
+		// Visit the atoms of the cells overlapping the cutoff sphere.
+		for (size_t x = beg[0]; x < end[0]; ++x)
+		for (size_t y = beg[1]; y < end[1]; ++y)
+		{
+			const fl gxy = gap_sqr[0][x - beg[0]] + gap_sqr[1][y - beg[1]];
+			if (gxy >= RF_Cutoff_Sqr) continue;
+			for (size_t z = beg[2]; z < end[2]; ++z)
+			{
+				if (gxy + gap_sqr[2][z - beg[2]] >= RF_Cutoff_Sqr) continue;
+				const size_t cell = num_rf_cells[2] * (num_rf_cells[1] * x + y) + z;
+				for (size_t l = rf_cell_offsets[cell]; l < rf_cell_offsets[cell + 1]; ++l)
+				{
+					const atom& a = rf_atoms[l];
+					const fl dist_sqr = distance_sqr(coordinate, a.coordinate);
+					if (dist_sqr < RF_Cutoff_Sqr) f(a, dist_sqr);
+				}
+			}
+		}
+	}
 };
 
 #endif
@@ -9,6 +9,7 @@
 using boost::ptr_vector;
 
 /// Represents a result found by BFGS local optimization for later clustering.
+/// Only heavy atom coordinates are kept, as hydrogen coordinates are needed only when the result is written as a model.
 class result
 {
 public:
@@ -16,70 +17,110 @@ public:
 	fl e; ///< Free energy.
 	fl f; ///< Inter-molecular free energy.
 	vector<vec3> heavy_atoms; ///< Heavy atom coordinates.
-	vector<vec3> hydrogens; ///< Hydrogen atom coordinates.
 
-	/// Constructs a result from free energy e, force f, heavy atom coordinates and hydrogen atom coordinates.
-	explicit result(const conformation& conf, const fl e, const fl f, vector<vec3>&& heavy_atoms_, vector<vec3>&& hydrogens_) : conf(conf), e(e), f(f), heavy_atoms(static_cast<vector<vec3>&&>(heavy_atoms_)), hydrogens(static_cast<vector<vec3>&&>(hydrogens_)) {}
+	/// Constructs a result from free energy e, force f and heavy atom coordinates.
+	explicit result(const conformation& conf, const fl e, const fl f, vector<vec3>&& heavy_atoms_) : conf(conf), e(e), f(f), heavy_atoms(static_cast<vector<vec3>&&>(heavy_atoms_)) {}
 
 	result(const result&) = default;
 	result(result&&) = default;
 	result& operator=(const result&) = default;
 	result& operator=(result&&) = default;
 
-	/// For sorting ptr_vector<result>.
+	/// For sorting results.
 	bool operator<(const result& r) const
 	{
 		return e < r.e;
 	}
 };
 
-// TODO: Do not inline large functions.
-// TODO: Consider using double linked list std::list<> to store results because of frequent insertions and deletions.
-/// Clusters a result into an existing result set with a minimum RMSD requirement.
-inline void add_to_result_container(ptr_vector<result>& results, result&& r, const fl required_square_error)
+/// Represents a fixed-capacity set of results clustered with a minimum RMSD requirement, in ascending order of free energy.
+/// The slots of results are allocated once and overwritten in place, so that adding results to a container in use does not allocate memory.
+class result_container
 {
-	// If this is the first result, simply save it.
-	if (results.empty())
+public:
+	typedef vector<result>::const_iterator const_iterator;
+
+	/// Constructs an empty container of a fixed capacity.
+	explicit result_container(const size_t capacity = 1) : slots(capacity, result(conformation(0), 0, 0, vector<vec3>())), n(0) {}
+
+	size_t size() const { return n; }
+	size_t capacity() const { return slots.size(); }
+	bool empty() const { return !n; }
+	const result& front() const { return slots.front(); }
+	const result& operator[](const size_t i) const { return slots[i]; }
+	const_iterator begin() const { return slots.begin(); }
+	const_iterator end() const { return slots.begin() + n; }
+
+	/// Removes all the results while keeping their slots for reuse.
+	void clear()
 	{
-		results.push_back(new result(static_cast<result&&>(r)));
-		return;
+		n = 0;
 	}
 
-	// If the container is not empty, find in a coordinate that is closest to the given newly found r.coordinate.
-	size_t index = 0;
-	fl best_square_error = distance_sqr(r.heavy_atoms, results.front().heavy_atoms);
-	for (size_t i = 1; i < results.size(); ++i)
+	/// Clusters a result of conformation conf, free energy e, inter-molecular free energy f and heavy atom coordinates into the container.
+	void add(const conformation& conf, const fl e, const fl f, const vector<vec3>& heavy_atoms, const fl required_square_error)
 	{
-		const fl this_square_error = distance_sqr(r.heavy_atoms, results[i].heavy_atoms);
-		if (this_square_error < best_square_error)
+		// If this is the first result, simply save it.
+		if (!n)
 		{
-			index = i;
-			best_square_error = this_square_error;
+			assign(n++, conf, e, f, heavy_atoms);
+			return;
 		}
-	}
 
-	if (best_square_error < required_square_error) // The result r is very close to results[index].
-	{
-		if (r.e < results[index].e) // r is better than results[index], so substitute r for results[index].
+		// If the container is not empty, find in a coordinate that is closest to the given newly found heavy atoms.
+		size_t index = 0;
+		fl best_square_error = distance_sqr(heavy_atoms, slots.front().heavy_atoms);
+		for (size_t i = 1; i < n; ++i)
 		{
-			results.replace(index, new result(static_cast<result&&>(r)));
+			const fl this_square_error = distance_sqr(heavy_atoms, slots[i].heavy_atoms);
+			if (this_square_error < best_square_error)
+			{
+				index = i;
+				best_square_error = this_square_error;
+			}
 		}
-	}
-	else // Cannot find in results a result that is similar to r.
-	{
-		if (results.size() < results.capacity())
+
+		if (best_square_error < required_square_error) // The result is very close to slots[index].
 		{
-			results.push_back(new result(static_cast<result&&>(r)));
+			if (e >= slots[index].e) return; // The result is not better than slots[index].
 		}
-		else // Now the container is full.
+		else if (n < slots.size()) // Cannot find a similar result, and there is room for a new one.
 		{
-			if (r.e < results.back().e) // If r is better than the worst one, then replace it.
-			{
-				results.replace(results.size() - 1, new result(static_cast<result&&>(r)));
-			}
+			index = n++;
 		}
+		else // Cannot find a similar result, and the container is full.
+		{
+			index = n - 1;
+			if (e >= slots[index].e) return; // The result is not better than the worst one.
+		}
+		assign(index, conf, e, f, heavy_atoms);
+
+		// Restore the ascending order of free energy. Swapping slots swaps their buffers without copying.
+		for (; index && slots[index].e < slots[index - 1].e; --index)
+		{
+			swap(slots[index], slots[index - 1]);
+		}
+		for (; index + 1 < n && slots[index + 1].e < slots[index].e; ++index)
+		{
+			swap(slots[index], slots[index + 1]);
+		}
+	}
+
+private:
+	/// Overwrites a slot, reusing the capacity of its buffers.
+	void assign(const size_t i, const conformation& conf, const fl e, const fl f, const vector<vec3>& heavy_atoms)
+	{
+		result& r = slots[i];
+		r.conf.position = conf.position;
+		r.conf.orientation = conf.orientation;
+		r.conf.torsions.assign(conf.torsions.begin(), conf.torsions.end());
+		r.e = e;
+		r.f = f;
+		r.heavy_atoms.assign(heavy_atoms.begin(), heavy_atoms.end());
 	}
-	results.sort();
-}
+
+	vector<result> slots; ///< Slots of results, the first n of which are in use.
+	size_t n; ///< Number of results.
+};
 
 #endif
@@ -0,0 +1,115 @@
+#include <cstdio>
+#include <ctime>
+#include <tuple>
+#include <algorithm>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include "result_cache.hpp"
+
+using namespace boost::filesystem;
+
+result_cache::result_cache(const path& dir, const uintmax_t capacity) : dir(dir), capacity(capacity)
+{
+	create_directories(dir);
+}
+
+path result_cache::context_dir(const uint64_t context) const
+{
+	char name[17];
+	snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(context));
+	return dir / name;
+}
+
+unordered_map<size_t, summary> result_cache::load(const uint64_t context, const size_t beg, const size_t end) const
+{
+	unordered_map<size_t, summary> summaries;
+	const auto cdir = context_dir(context);
+	boost::system::error_code ec;
+	if (!is_directory(cdir, ec)) return summaries;
+	last_write_time(cdir, time(nullptr), ec);
+	summary s(0, 0, 0, conformation(0));
+	for (directory_iterator it(cdir, ec), last; !ec && it != last; it.increment(ec))
+	{
+		if (it->path().extension() != ".bin") continue; // Skip segments being written.
+		unsigned long long seg_beg, seg_end;
+		if (sscanf(it->path().filename().string().c_str(), "%llu-%llu-", &seg_beg, &seg_end) == 2 && (seg_end <= beg || end <= seg_beg)) continue; // Skip segments of other ranges.
+		boost::filesystem::ifstream in(it->path(), ios::binary);
+		while (read_summary(in, s))
+		{
+			if (s.index < beg || s.index >= end) continue;
+			const auto p = summaries.emplace(s.index, s);
+			if (!p.second && s.energy < p.first->second.energy) p.first->second = s; // Keep the best of duplicate results, e.g. from concurrent jobs.
+		}
+	}
+	return summaries;
+}
+
+void result_cache::store(const uint64_t context, const size_t beg, const size_t end, const vector<summary>& summaries) const
+{
+	if (summaries.empty()) return;
+	const auto cdir = context_dir(context);
+	create_directories(cdir);
+	const auto segment = cdir / unique_path(to_string(beg) + '-' + to_string(end) + "-%%%%%%%%%%%%%%%%.bin");
+	auto part = segment;
+	part.replace_extension(".part");
+	{
+		boost::filesystem::ofstream out(part, ios::binary);
+		for (const auto& s : summaries)
+		{
+			write_summary(out, s);
+		}
+	}
+	rename(part, segment);
+	last_write_time(cdir, time(nullptr));
+	evict(segment);
+}
+
+void result_cache::evict(const path& segment) const
+{
+	const auto keep = segment.parent_path();
+	// Measure the size and the last use of every context.
+	vector<tuple<time_t, uintmax_t, path>> contexts;
+	uintmax_t total = 0;
+	boost::system::error_code ec;
+	for (directory_iterator it(dir, ec), last; !ec && it != last; it.increment(ec))
+	{
+		if (!is_directory(it->path(), ec)) continue;
+		uintmax_t size = 0;
+		for (directory_iterator sit(it->path(), ec), slast; !ec && sit != slast; sit.increment(ec))
+		{
+			const auto n = file_size(sit->path(), ec);
+			if (!ec) size += n;
+		}
+		ec.clear();
+		total += size;
+		if (it->path() != keep) contexts.emplace_back(last_write_time(it->path(), ec), size, it->path());
+	}
+	if (total <= capacity) return;
+
+	// Remove the least recently used contexts first.
+	sort(contexts.begin(), contexts.end());
+	for (const auto& c : contexts)
+	{
+		if (total <= capacity) break;
+		remove_all(get<2>(c), ec);
+		if (!ec) total -= get<1>(c);
+	}
+	if (total <= capacity) return;
+
+	// Remove the oldest segments of the kept context other than the given one, so that a single context cannot outgrow the capacity either.
+	vector<tuple<time_t, uintmax_t, path>> segments;
+	for (directory_iterator it(keep, ec), last; !ec && it != last; it.increment(ec))
+	{
+		if (it->path() == segment || it->path().extension() != ".bin") continue;
+		const auto size = file_size(it->path(), ec);
+		if (ec) continue;
+		segments.emplace_back(last_write_time(it->path(), ec), size, it->path());
+	}
+	sort(segments.begin(), segments.end());
+	for (const auto& s : segments)
+	{
+		if (total <= capacity) break;
+		remove(get<2>(s), ec);
+		if (!ec) total -= get<1>(s);
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+#ifndef IDOCK_RESULT_CACHE_HPP
+#define IDOCK_RESULT_CACHE_HPP
+
+#include <unordered_map>
+#include <boost/filesystem/path.hpp>
+#include "summary.hpp"
+using namespace std;
+using boost::filesystem::path;
+
+/// Represents a local on-disk cache of docking results shared across jobs.
+/// Results are grouped by context, i.e. a hash of everything but the ligand that determines a result, e.g. the receptor, the box and the docking settings.
+/// Each context is a directory of segment files of summary records. A segment is written to a temporary file and renamed into place, so that concurrent readers and writers never see partial segments.
+/// A segment holds the results of one range of ligand indexes, e.g. a slice, which is part of its name, so that loading a range reads only the segments that overlap it.
+/// The total size of the cache is bounded by evicting whole contexts in the order of least recent use, and then the oldest segments of the context being written.
+class result_cache
+{
+public:
+	/// Opens a cache directory, creating it if necessary, whose files may total at most capacity bytes.
+	explicit result_cache(const path& dir, const uintmax_t capacity);
+
+	/// Returns the cached summaries of a context for the ligands in [beg, end), keyed by ligand index, and marks the context as recently used.
+	unordered_map<size_t, summary> load(const uint64_t context, const size_t beg, const size_t end) const;
+
+	/// Stores the summaries of a context for the ligands in [beg, end) as a new segment, and evicts least recently used contexts and segments if the cache has outgrown its capacity.
+	void store(const uint64_t context, const size_t beg, const size_t end, const vector<summary>& summaries) const;
+
+private:
+	/// Returns the directory of a context.
+	path context_dir(const uint64_t context) const;
+
+	/// Removes least recently used contexts other than that of the given segment, and then the oldest other segments of its context, until the cache fits in its capacity.
+	void evict(const path& segment) const;
+
+	const path dir; ///< Cache directory.
+	const uintmax_t capacity; ///< Maximum total size of segment files in bytes.
+};
+
+#endif
@@ -5,6 +5,39 @@ const fl scoring_function::Cutoff_Sqr = Cutoff * Cutoff;
 const fl scoring_function::Factor = static_cast<fl>(256);
 const fl scoring_function::Factor_Inverse = 1 / Factor;
 const size_t scoring_function::Num_Samples = static_cast<size_t>(Factor * Cutoff_Sqr) + 1;
+const fl scoring_function::Compact_Factor = static_cast<fl>(32);
+const size_t scoring_function::Num_Compact_Samples = static_cast<size_t>(Compact_Factor * Cutoff_Sqr) + 1;
+
+scoring_function::scoring_function(const bool compact) : compact(compact), rows(XS_TYPE_SIZE * (XS_TYPE_SIZE + 1) >> 1)
+{
+	for (size_t t1 =  0; t1 < XS_TYPE_SIZE; ++t1)
+	for (size_t t2 = t1; t2 < XS_TYPE_SIZE; ++t2)
+	{
+		size_t& row = rows[triangular_matrix_restrictive_index(t1, t2)];
+
+		// In a compact table, type pairs with the same sum of van der Waals radii, hydrophobicity and hydrogen bonding share a row, as their functions are identical.
+		for (row = 0; compact && row < row_types.size(); ++row)
+		{
+			const size_t u1 = row_types[row][0];
+			const size_t u2 = row_types[row][1];
+			if (xs_vdw_radius(t1) + xs_vdw_radius(t2) == xs_vdw_radius(u1) + xs_vdw_radius(u2) && xs_is_hydrophobic(t1, t2) == xs_is_hydrophobic(u1, u2) && xs_hbond(t1, t2) == xs_hbond(u1, u2)) break;
+		}
+		if (row == row_types.size() || !compact)
+		{
+			row = row_types.size();
+			const array<size_t, 2> types = {{ t1, t2 }};
+			row_types.push_back(types);
+		}
+	}
+	if (compact)
+	{
+		compact_es.resize((Num_Compact_Samples + 1) * row_types.size());
+	}
+	else
+	{
+		elements.resize(Num_Samples * row_types.size());
+	}
+}
 
 fl scoring_function::score(const size_t t1, const size_t t2, const fl r)
 {
@@ -32,28 +65,38 @@ void scoring_function::score(float* const v, const size_t t1, const size_t t2, c
 	v[4] += xs_hbond(t1, t2) ? (d >= 0.0f ? 0.0f : (d <= -0.7f ? 1.0f : d * -1.4285714285714286f)) : 0.0f;
 }
 
-void scoring_function::precalculate(const size_t t1, const size_t t2, const vector<fl>& rs)
+void scoring_function::precalculate(const size_t row)
 {
-	vector<scoring_function_element>& p = (*this)[triangular_matrix_restrictive_index(t1, t2)];
-	BOOST_ASSERT(p.size() == Num_Samples);
+	const size_t t1 = row_types[row][0];
+	const size_t t2 = row_types[row][1];
+
+	if (compact)
+	{
+		float* const p = &compact_es[(Num_Compact_Samples + 1) * row];
+		for (size_t i = 0; i < Num_Compact_Samples; ++i)
+		{
+			p[i] = static_cast<float>(score(t1, t2, sqrt(i / Compact_Factor)));
+		}
+		p[Num_Compact_Samples] = p[Num_Compact_Samples - 1];
+		return;
+	}
 
 	// Calculate the value of scoring function evaluated at (t1, t2, d).
+	scoring_function_element* const p = &elements[Num_Samples * row];
+	vector<fl> rs(Num_Samples);
 	for (size_t i = 0; i < Num_Samples; ++i)
 	{
+		rs[i] = sqrt(i * Factor_Inverse);
 		p[i].e = score(t1, t2, rs[i]);
 	}
+	BOOST_ASSERT(rs.front() == 0);
+	BOOST_ASSERT(rs.back() == Cutoff);
 
 	// Calculate the dor of scoring function evaluated at (t1, t2, d).
 	for (size_t i = 1; i < Num_Samples - 1; ++i)
 	{
 		p[i].dor = (p[i + 1].e - p[i].e) / ((rs[i + 1] - rs[i]) * rs[i]);
 	}
-	p.front().dor = 0;
-	p.back().dor = 0;
-}
-
-scoring_function_element scoring_function::evaluate(const size_t type_pair_index, const fl r2) const
-{
-	BOOST_ASSERT(r2 <= Cutoff_Sqr);
-	return (*this)[type_pair_index][static_cast<size_t>(Factor * r2)];
+	p[0].dor = 0;
+	p[Num_Samples - 1].dor = 0;
 }
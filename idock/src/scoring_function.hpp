@@ -13,13 +13,19 @@ public:
 	fl dor; ///< Scoring function derivative over r.
 };
 
-/// Represents a scoring function.
-class scoring_function : private triangular_matrix<vector<scoring_function_element>>
+/// Represents a scoring function, tabulated over r2 in one contiguous allocation for every pair of XScore atom types.
+/// The full table holds double samples every 1 / Factor A^2, looked up without interpolation.
+/// The compact table holds float samples every 1 / Compact_Factor A^2 for the distinct type pairs only, and interpolates linearly between them, so that it fits in L2 cache.
+/// Type pairs are distinct if their functions differ, i.e. by van der Waals radius sum, hydrophobicity or hydrogen bonding, which leaves 36 rows of the 120 type pairs.
+/// Every type pair keeps a row regardless of whether it occurs, because the ligand atom types, and hence the pairs used by grid maps and intra-ligand terms, are known only once each ligand is loaded.
+class scoring_function
 {
 public:
 	static const fl Cutoff; ///< Cutoff of a scoring function.
 	static const fl Cutoff_Sqr; ///< Square of Cutoff.
 	static const size_t Num_Samples; ///< Number of sampling points within [0, Cutoff].
+	static const fl Compact_Factor; ///< Scaling factor for r2 in the compact table.
+	static const size_t Num_Compact_Samples; ///< Number of sampling points within [0, Cutoff] in the compact table.
 
 	/// Returns the score between two atoms of XScore atom types t1 and t2 and distance r.
 	static fl score(const size_t t1, const size_t t2, const fl r);
@@ -27,17 +33,45 @@ public:
 	/// Return the scoring function evaluated at (t1, t2, r).
 	static void score(float* const v, const size_t t1, const size_t t2, const float r2);
 
-	/// Constructs an empty scoring function.
-	scoring_function() : triangular_matrix<vector<scoring_function_element>>(XS_TYPE_SIZE, vector<scoring_function_element>(Num_Samples, scoring_function_element())) {}
+	/// Constructs an empty scoring function, either full or compact.
+	explicit scoring_function(const bool compact = false);
 
-	/// Precalculates the scoring function values of sample points for the type combination of t1 and t2.
-	void precalculate(const size_t t1, const size_t t2, const vector<fl>& rs);
+	/// Returns the number of rows to precalculate, each of which is a type pair in a full table, or a distinct type pair in a compact table.
+	size_t num_rows() const
+	{
+		return row_types.size();
+	}
+
+	/// Precalculates the scoring function values of sample points for a row.
+	void precalculate(const size_t row);
 
 	/// Evaluates the scoring function given (t1, t2, r2).
-	scoring_function_element evaluate(const size_t type_pair_index, const fl r2) const;
+	scoring_function_element evaluate(const size_t type_pair_index, const fl r2) const
+	{
+		BOOST_ASSERT(r2 <= Cutoff_Sqr);
+		const size_t row = rows[type_pair_index];
+		if (!compact) return elements[Num_Samples * row + static_cast<size_t>(Factor * r2)];
+
+		// The dor of the interpolant over r is its slope over r2 times 2.
+		const fl s = Compact_Factor * r2;
+		const size_t k = static_cast<size_t>(s);
+		const float* const p = &compact_es[(Num_Compact_Samples + 1) * row + k];
+		const fl slope = p[1] - p[0];
+		scoring_function_element element;
+		element.e = p[0] + slope * (s - k);
+		element.dor = slope * (2 * Compact_Factor);
+		return element;
+	}
 
 	static const fl Factor; ///< Scaling factor for r, i.e. distance between two atoms.
 	static const fl Factor_Inverse; ///< 1 / Factor.
+
+private:
+	const bool compact; ///< True if the table is compact.
+	vector<size_t> rows; ///< Row of each type pair index.
+	vector<array<size_t, 2>> row_types; ///< A type pair of each row.
+	vector<scoring_function_element> elements; ///< Full table, Num_Samples per row.
+	vector<float> compact_es; ///< Compact table, Num_Compact_Samples per row plus a copy of the last one, so that interpolation at Cutoff_Sqr stays within the row.
 };
 
 #endif
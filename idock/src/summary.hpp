@@ -2,6 +2,8 @@
 #ifndef IDOCK_SUMMARY_HPP
 #define IDOCK_SUMMARY_HPP
 
+#include <istream>
+#include <ostream>
 #include "conformation.hpp"
 
 /// Represents a summary of docking results of a ligand.
@@ -12,7 +14,9 @@ public:
 	fl energy;
 	fl rfscore;
 	conformation conf;
-	explicit summary(const size_t index, const fl energy, const fl rfscore, const conformation& conf) : index(index), energy(energy), rfscore(rfscore), conf(conf)
+	size_t target; ///< Index of the target, i.e. the receptor and box, the ligand was docked against.
+	size_t source; ///< Index of the ligand whose input coordinates the conformation applies to, which differs from index if the results were copied from another ligand of the same structure.
+	explicit summary(const size_t index, const fl energy, const fl rfscore, const conformation& conf, const size_t target = 0) : index(index), energy(energy), rfscore(rfscore), conf(conf), target(target), source(index)
 	{
 	}
 
@@ -22,11 +26,61 @@ public:
 	summary& operator=(summary&&) = default;
 };
 
-/// For sorting ptr_vector<summary>.
+/// For sorting ptr_vector<summary>. Ties are broken by ligand index, so that every ranking of the same results, e.g. the running hits and the merged slices, agrees on the order.
 inline bool operator<(const summary& a, const summary& b)
 {
-	return a.energy < b.energy;
+	return a.energy < b.energy || (a.energy == b.energy && a.index < b.index);
 //	return a.rfscore > b.rfscore;
 }
 
+/// Represents the fixed-layout part of a binary summary record, which is followed by num_torsions torsions.
+struct summary_record
+{
+	uint64_t index;
+	uint64_t target;
+	uint64_t source;
+	uint64_t num_torsions;
+	fl energy;
+	fl rfscore;
+	fl position[3];
+	fl orientation[4];
+};
+
+/// Writes a summary as a binary record.
+inline void write_summary(std::ostream& os, const summary& s)
+{
+	summary_record r;
+	r.index = s.index;
+	r.target = s.target;
+	r.source = s.source;
+	r.num_torsions = s.conf.torsions.size();
+	r.energy = s.energy;
+	r.rfscore = s.rfscore;
+	r.position[0] = s.conf.position[0];
+	r.position[1] = s.conf.position[1];
+	r.position[2] = s.conf.position[2];
+	r.orientation[0] = s.conf.orientation.a;
+	r.orientation[1] = s.conf.orientation.b;
+	r.orientation[2] = s.conf.orientation.c;
+	r.orientation[3] = s.conf.orientation.d;
+	os.write(reinterpret_cast<const char*>(&r), sizeof(r));
+	os.write(reinterpret_cast<const char*>(s.conf.torsions.data()), sizeof(fl) * r.num_torsions);
+}
+
+/// Reads a binary record into a summary, reusing the storage of its torsions. Returns false if the stream holds no more complete records.
+inline bool read_summary(std::istream& is, summary& s)
+{
+	summary_record r;
+	if (!is.read(reinterpret_cast<char*>(&r), sizeof(r))) return false;
+	s.index = r.index;
+	s.target = r.target;
+	s.source = r.source;
+	s.energy = r.energy;
+	s.rfscore = r.rfscore;
+	s.conf.position = vec3(r.position[0], r.position[1], r.position[2]);
+	s.conf.orientation = qtn4(r.orientation[0], r.orientation[1], r.orientation[2], r.orientation[3]);
+	s.conf.torsions.resize(r.num_torsions);
+	return static_cast<bool>(is.read(reinterpret_cast<char*>(s.conf.torsions.data()), sizeof(fl) * r.num_torsions));
+}
+
 #endif
@@ -6,6 +6,7 @@
 #include <boost/filesystem/fstream.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/stream.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <cuda_runtime_api.h>
 #include <helper_cuda.h>
@@ -15,6 +16,8 @@
 #include <Poco/Net/SMTPClientSession.h>
 #include <curl/curl.h>
 #include "kernel.hpp"
+#include "transport.hpp"
+#include "finalizer.hpp"
 
 using namespace std;
 using namespace std::chrono;
@@ -31,14 +34,6 @@ inline static string local_time()
 	return to_simple_string(microsec_clock::local_time()) + " ";
 }
 
-size_t read_from_stringstream(char *buffer, size_t size, size_t count, istringstream *ss)
-{
-	assert(size == 1);
-	if (ss->eof()) return 0;
-	ss->read(buffer, count);
-	return count;
-}
-
 /**
  * Encode a character to its 2-bit binary representation.
  * The last two but one bits are different for A, C, G, and T respectively.
@@ -223,6 +218,7 @@ int main(int argc, char** argv)
 	const auto collection = "istar.igrep";
 	const auto private_keyfile = string(getenv("HOME")) + "/.ssh/id_rsa";
 	const auto public_keyfile = private_keyfile + ".pub";
+	const auto tr = make_transport(rmt_jobs_path.string(), private_keyfile, public_keyfile); // A local rmt_jobs_path stands in for the remote host.
 
 	// Initialize genomes.
 	vector<genome> genomes;
@@ -268,6 +264,12 @@ int main(int argc, char** argv)
 	// Initialize curl globally.
 	curl_global_init(CURL_GLOBAL_DEFAULT);
 
+	// Start the finalizer, which sends notification emails in the background.
+	finalizer fin([](const string& msg)
+	{
+		cerr << local_time() << msg << endl;
+	});
+
 	while (true)
 	{
 		// Fetch jobs.
@@ -295,8 +297,11 @@ int main(int argc, char** argv)
 			checkCudaErrors(cudaMalloc((void**)&match_device, sizeof(unsigned int) * max_match_count));
 			initAgrepKernel(scodon_device, g.character_count, match_device, max_match_count);
 
-			// Create output string streams.
-			stringstream log, pos;
+			// Create output streams, which are written remotely while the genome is being searched.
+			const path rmt_job_path = rmt_jobs_path / _id.str();
+			upload_sink log_sink(*tr, (rmt_job_path / "log.csv").string());
+			upload_sink pos_sink(*tr, (rmt_job_path / "pos.csv").string());
+			boost::iostreams::stream<upload_sink> log(log_sink), pos(pos_sink);
 			log << "Query Index,Pattern,Edit Distance,Number of Matches\n";
 			pos << "Query Index,Match Index,File Index,Ending Position\n";
 
@@ -403,25 +408,15 @@ int main(int argc, char** argv)
 			checkCudaErrors(cudaFree(scodon_device));
 			checkCudaErrors(cudaDeviceReset());
 
-			// Write output files remotely via SSH SCP.
-			const path rmt_job_path = rmt_jobs_path / _id.str();
-			const auto curl = curl_easy_init();
-			curl_easy_setopt(curl, CURLOPT_SSH_AUTH_TYPES, CURLSSH_AUTH_PUBLICKEY);
-			curl_easy_setopt(curl, CURLOPT_SSH_PRIVATE_KEYFILE, private_keyfile.c_str());
-			curl_easy_setopt(curl, CURLOPT_SSH_PUBLIC_KEYFILE, public_keyfile.c_str());
-			curl_easy_setopt(curl, CURLOPT_UPLOAD, 1);
-			curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_from_stringstream);
-			curl_easy_setopt(curl, CURLOPT_URL, (rmt_job_path / "log.csv").c_str());
-			curl_easy_setopt(curl, CURLOPT_INFILESIZE, log.tellp());
-			curl_easy_setopt(curl, CURLOPT_READDATA, &log);
-			curl_easy_perform(curl);
-			curl_easy_setopt(curl, CURLOPT_URL, (rmt_job_path / "pos.csv").c_str());
-			curl_easy_setopt(curl, CURLOPT_INFILESIZE, pos.tellp());
-			curl_easy_setopt(curl, CURLOPT_READDATA, &pos);
-			curl_easy_perform(curl);
-			curl_easy_cleanup(curl);
+			// Finish writing output files remotely.
+			log.close();
+			pos.close();
+			if (!log_sink.succeeded() || !pos_sink.succeeded())
+			{
+				cerr << local_time() << "Failed to upload output files to " << rmt_job_path << endl;
+			}
 
-			// Update progress.
+			// Update progress. The completed field is set right away, as it also prevents the job from being fetched again.
 			const auto millis_since_epoch = duration_cast<std::chrono::milliseconds>(system_clock::now().time_since_epoch()).count();
 			conn.update(collection, BSON("_id" << _id), BSON("$set" << BSON("completed" << Date_t(millis_since_epoch))));
 			const auto err = conn.getLastError();
@@ -430,18 +425,26 @@ int main(int argc, char** argv)
 				cerr << local_time() << err << endl;
 			}
 
-			// Send completion notification email.
+			// Send completion notification email in the background, so that the next job can be searched right away.
 			const auto email = job["email"].String();
-			cout << local_time() << "Sending a completion notification email to " << email << endl;
-			MailMessage message;
-			message.setSender("igrep <noreply@cse.cuhk.edu.hk>");
-			message.setSubject("Your igrep job has completed");
-			message.setContent("Genome to search: " + g.name + "\nPatterns to search for: " + to_string(qi) + "\nSubmitted: " + to_simple_string(ptime(epoch, boost::posix_time::milliseconds(job["submitted"].Date().millis))) + " UTC\nCompleted: " + to_simple_string(ptime(epoch, boost::posix_time::milliseconds(millis_since_epoch))) + " UTC\nResult: http://istar.cse.cuhk.edu.hk/igrep");
-			message.addRecipient(MailRecipient(MailRecipient::PRIMARY_RECIPIENT, email));
-			SMTPClientSession session("137.189.91.190");
-			session.login();
-			session.sendMessage(message);
-			session.close();
+			const auto content = "Genome to search: " + g.name + "\nPatterns to search for: " + to_string(qi) + "\nSubmitted: " + to_simple_string(ptime(epoch, boost::posix_time::milliseconds(job["submitted"].Date().millis))) + " UTC\nCompleted: " + to_simple_string(ptime(epoch, boost::posix_time::milliseconds(millis_since_epoch))) + " UTC\nResult: http://istar.cse.cuhk.edu.hk/igrep";
+			fin.post(_id.str(),
+			{
+				{ "send a completion notification email", [email, content]()
+				{
+					cout << local_time() << "Sending a completion notification email to " << email << endl;
+					MailMessage message;
+					message.setSender("igrep <noreply@cse.cuhk.edu.hk>");
+					message.setSubject("Your igrep job has completed");
+					message.setContent(content);
+					message.addRecipient(MailRecipient(MailRecipient::PRIMARY_RECIPIENT, email));
+					SMTPClientSession session("137.189.91.190");
+					session.login();
+					session.sendMessage(message);
+					session.close();
+					return true;
+				}},
+			});
 		}
 
 		// Sleep for a second.
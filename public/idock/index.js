@@ -14,6 +14,9 @@ $(function() {
 				num_completed_ligands += parseInt(job[i]);
 			}
 			progress = num_completed_ligands * job.max_ligands_inv;
+			if (job.partial_hits) {
+				result += '<a href="jobs/' + job._id + '/partial_hits.csv.gz"><img src="/excel.png" alt="partial_hits.csv.gz" title="Hits of the slices finished so far"></a>';
+			}
 		} else {
 			status = 'Completed ' + $.format.date(new Date(job.completed), 'yyyy/MM/dd HH:mm:ss');
 			progress = 1;
@@ -38,6 +41,7 @@ $(function() {
 					var job = res[i - skip];
 					jobs[i].scheduled = job.scheduled;
 					jobs[i].completed = job.completed;
+					jobs[i].partial_hits = job.partial_hits;
 					for (var s = 0; s < job.scheduled; ++s) {
 						jobs[i][s] = job[s];
 					}
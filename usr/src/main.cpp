@@ -22,6 +22,9 @@
 #include <Poco/Net/MailMessage.h>
 #include <Poco/Net/MailRecipient.h>
 #include <Poco/Net/SMTPClientSession.h>
+#include "parallel_gzip.hpp"
+#include "text_buffer.hpp"
+#include "finalizer.hpp"
 using namespace std;
 using namespace std::chrono;
 using namespace OpenBabel;
@@ -230,12 +233,13 @@ int main(int argc, char* argv[])
 	const auto pwd = argv[3];
 	const path jobs_path = argv[4];
 
-	// Connect to host and authenticate user.
-	DBClientConnection conn;
+	// Connect to host and authenticate user, once for the event loop and once for the finalizer thread, as connections are not thread safe.
+	DBClientConnection conn, fin_conn;
+	for (auto c : { &conn, &fin_conn })
 	{
 		cout << local_time() << "Connecting to " << host << " and authenticating " << user << endl;
 		string errmsg;
-		if ((!conn.connect(host, errmsg)) || (!conn.auth("istar", user, pwd, errmsg)))
+		if ((!c->connect(host, errmsg)) || (!c->auth("istar", user, pwd, errmsg)))
 		{
 			cerr << local_time() << errmsg << endl;
 			return 1;
@@ -272,6 +276,12 @@ int main(int argc, char* argv[])
 	alignas(32) std::array<double, qn.back()> q;
 	alignas(32) std::array<double, qn.back()> l;
 
+	// Start the finalizer, which marks jobs as completed and notifies their owners in the background.
+	finalizer fin([](const string& msg)
+	{
+		cerr << local_time() << msg << endl;
+	});
+
 	// Enter event loop.
 	cout << local_time() << "Entering event loop" << endl;
 	cout.setf(ios::fixed, ios::floatfield);
@@ -516,57 +526,56 @@ int main(int argc, char* argv[])
 		});
 
 		// Write results.
+		boost::filesystem::ofstream hits_csv_gz_file(job_path / "hits.csv.gz", ios::binary);
 		filtering_ostream hits_csv_gz;
-		hits_csv_gz.push(gzip_compressor());
-		hits_csv_gz.push(file_sink((job_path / "hits.csv.gz").string()));
-		hits_csv_gz.setf(ios::fixed, ios::floatfield);
-		hits_csv_gz << "ZINC ID,USR score,USRCAT score\n" << setprecision(8);
+		hits_csv_gz.push(parallel_gzip_sink(hits_csv_gz_file));
+		hits_csv_gz << "ZINC ID,USR score,USRCAT score\n";
+		boost::filesystem::ofstream hits_pdbqt_gz_file(job_path / "hits.pdbqt.gz", ios::binary);
 		filtering_ostream hits_pdbqt_gz;
-		hits_pdbqt_gz.push(gzip_compressor());
-		hits_pdbqt_gz.push(file_sink((job_path / "hits.pdbqt.gz").string()));
-		hits_pdbqt_gz.setf(ios::fixed, ios::floatfield);
+		hits_pdbqt_gz.push(parallel_gzip_sink(hits_pdbqt_gz_file));
+		text_buffer hits_csv_rows(1 << 16), hits_pdbqt_models(1 << 16);
 		for (size_t t = 0, n = min<size_t>(10000, num_ligands); t < n; ++t)
 		{
 			const size_t k = scase[t];
 			const auto zincid = zincids[k].substr(0, 8); // Take another substr() to get rid of the trailing newline.
 			const auto u0score = 1 / (1 + scores[0][k] * qv[0]);
 			const auto u1score = 1 / (1 + scores[1][k] * qv[1]);
-			hits_csv_gz << zincid << ',' << u0score << ',' << u1score << '\n';
+			hits_csv_rows.put(zincid).put(',').put_fixed(u0score, 8).put(',').put_fixed(u1score, 8).put('\n');
 
 			// Only write conformations of the top ligands to ligands.pdbqt.gz.
 			if (t >= 1000) continue;
 
 			const auto zfp = zfproperties[k];
 			const auto zip = ziproperties[k];
-			hits_pdbqt_gz
-				<< "MODEL " << '\n'
-				<< "REMARK 911 " << zincid
-				<< setprecision(3)
-				<< ' ' << setw(8) << zfp[0]
-				<< ' ' << setw(8) << zfp[1]
-				<< ' ' << setw(8) << zfp[2]
-				<< ' ' << setw(8) << zfp[3]
-				<< ' ' << setw(3) << zip[0]
-				<< ' ' << setw(3) << zip[1]
-				<< ' ' << setw(3) << zip[2]
-				<< ' ' << setw(3) << zip[3]
-				<< ' ' << setw(3) << zip[4]
-				<< '\n'
-				<< "REMARK 912 " << smileses[k]  // A newline is already included in smileses[k].
-				<< "REMARK 913 " << suppliers[k] // A newline is already included in suppliers[k].
-				<< setprecision(8)
-				<< "REMARK 951    USR SCORE: " << setw(10) << u0score << '\n'
-				<< "REMARK 952 USRCAT SCORE: " << setw(10) << u1score << '\n'
+			hits_pdbqt_models
+				.put("MODEL \n")
+				.put("REMARK 911 ").put(zincid)
+				.put(' ').put_fixed(zfp[0], 3, 8)
+				.put(' ').put_fixed(zfp[1], 3, 8)
+				.put(' ').put_fixed(zfp[2], 3, 8)
+				.put(' ').put_fixed(zfp[3], 3, 8)
+				.put(' ').put_int(zip[0], 3)
+				.put(' ').put_int(zip[1], 3)
+				.put(' ').put_int(zip[2], 3)
+				.put(' ').put_int(zip[3], 3)
+				.put(' ').put_int(zip[4], 3)
+				.put('\n')
+				.put("REMARK 912 ").put(smileses[k])  // A newline is already included in smileses[k].
+				.put("REMARK 913 ").put(suppliers[k]) // A newline is already included in suppliers[k].
+				.put("REMARK 951    USR SCORE: ").put_fixed(u0score, 8, 10).put('\n')
+				.put("REMARK 952 USRCAT SCORE: ").put_fixed(u1score, 8, 10).put('\n')
+				.put(ligands[k])
+				.put("ENDMDL\n")
 			;
-			const auto lig = ligands[k];
-			hits_pdbqt_gz.write(lig.data(), lig.size());
-			hits_pdbqt_gz << "ENDMDL\n";
+			if (hits_pdbqt_models.size() >= 1 << 16) hits_pdbqt_models.flush(hits_pdbqt_gz);
 		}
+		hits_csv_rows.flush(hits_csv_gz);
+		hits_pdbqt_models.flush(hits_pdbqt_gz);
 
-		// Update progress.
-		cout << local_time() << "Setting completed time" << endl;
+		// Close the output files before the job can be marked as completed.
+		hits_csv_gz.reset();
+		hits_pdbqt_gz.reset();
 		const auto completed = milliseconds_since_epoch();
-		conn.update(collection, BSON("_id" << _id), BSON("$set" << BSON("completed" << completed)));
 
 		// Calculate runtime in seconds and screening speed in million molecules per second.
 		const auto runtime = (completed - started) * 0.001;
@@ -576,16 +585,30 @@ int main(int argc, char* argv[])
 			<< local_time() << "Screening speed was " << setprecision(0) << speed << " K molecules per second" << endl
 		;
 
-		// Send completion notification email.
-		cout << local_time() << "Sending a completion notification email to " << email << endl;
-		MailMessage message;
-		message.setSender("istar <noreply@cse.cuhk.edu.hk>");
-		message.setSubject("Your usr job has completed");
-		message.setContent("Description: " + job["description"].String() + "\nSubmitted: " + to_simple_string(ptime(epoch, boost::posix_time::milliseconds(job["submitted"].Date().millis))) + " UTC\nCompleted: " + to_simple_string(ptime(epoch, boost::posix_time::milliseconds(completed))) + " UTC\nResult: http://istar.cse.cuhk.edu.hk/usr/iview/?" + _id.str());
-		message.addRecipient(MailRecipient(MailRecipient::PRIMARY_RECIPIENT, email));
-		SMTPClientSession session("137.189.91.190");
-		session.login();
-		session.sendMessage(message);
-		session.close();
+		// Hand over the completion side effects to the finalizer, so that the next job can be fetched right away.
+		cout << local_time() << "Queuing job " << _id.str() << " for finalization" << endl;
+		const auto content = "Description: " + job["description"].String() + "\nSubmitted: " + to_simple_string(ptime(epoch, boost::posix_time::milliseconds(job["submitted"].Date().millis))) + " UTC\nCompleted: " + to_simple_string(ptime(epoch, boost::posix_time::milliseconds(completed))) + " UTC\nResult: http://istar.cse.cuhk.edu.hk/usr/iview/?" + _id.str();
+		fin.post(_id.str(),
+		{
+			{ "set completed time", [&, _id, completed]()
+			{
+				fin_conn.update(collection, BSON("_id" << _id), BSON("$set" << BSON("completed" << completed)));
+				return fin_conn.getLastError().empty();
+			}},
+			{ "send a completion notification email", [email, content]()
+			{
+				cout << local_time() << "Sending a completion notification email to " << email << endl;
+				MailMessage message;
+				message.setSender("istar <noreply@cse.cuhk.edu.hk>");
+				message.setSubject("Your usr job has completed");
+				message.setContent(content);
+				message.addRecipient(MailRecipient(MailRecipient::PRIMARY_RECIPIENT, email));
+				SMTPClientSession session("137.189.91.190");
+				session.login();
+				session.sendMessage(message);
+				session.close();
+				return true;
+			}},
+		});
 	}
 }
@@ -4,54 +4,65 @@ var fs = require('fs'),
 	cluster = require('cluster');
 if (cluster.isMaster) {
 	process.env.PYTHONPATH = process.env.MGL_ROOT + '/MGLToolsPckgs';
-	// Allocate arrays to hold ligand properties
-	var num_ligands = 23129083,
-		mwt = new Float32Array(num_ligands),
-		lgp = new Float32Array(num_ligands),
-		ads = new Float32Array(num_ligands),
-		pds = new Float32Array(num_ligands),
-		hbd = new Int16Array(num_ligands),
-		hba = new Int16Array(num_ligands),
-		psa = new Int16Array(num_ligands),
-		chg = new Int16Array(num_ligands),
-		nrb = new Int16Array(num_ligands);
-	// Parse ligand properties
-	var prop = 'idock/16_zprop.bin';
-	console.log('Parsing %s', prop);
-	var start = Date.now();
-	fs.readFile(prop, function(err, buf) {
-		if (err) throw err;
-		for (i = 0, o = 0; i < num_ligands; ++i, o += 26) {
-			mwt[i] = buf.readFloatLE(o +  0);
-			lgp[i] = buf.readFloatLE(o +  4);
-			ads[i] = buf.readFloatLE(o +  8);
-			pds[i] = buf.readFloatLE(o + 12);
-			hbd[i] = buf.readInt16LE(o + 16);
-			hba[i] = buf.readInt16LE(o + 18);
-			psa[i] = buf.readInt16LE(o + 20);
-			chg[i] = buf.readInt16LE(o + 22);
-			nrb[i] = buf.readInt16LE(o + 24);
-		}
-		console.log('Parsed %d ligands within %d milliseconds', num_ligands, Date.now() - start);
-		// Fork worker processes with cluster
-		var numCPUs = require('os').cpus().length;
-		console.log('Forking %d worker processes', numCPUs);
-		var msg = function(m) {
-			if (m.query == '/idock/ligands') {
-				var ligands = 0;
-				for (var i = 0; i < num_ligands; ++i) {
-					if ((m.mwt_lb <= mwt[i]) && (mwt[i] <= m.mwt_ub) && (m.lgp_lb <= lgp[i]) && (lgp[i] <= m.lgp_ub) && (m.ads_lb <= ads[i]) && (ads[i] <= m.ads_ub) && (m.pds_lb <= pds[i]) && (pds[i] <= m.pds_ub) && (m.hbd_lb <= hbd[i]) && (hbd[i] <= m.hbd_ub) && (m.hba_lb <= hba[i]) && (hba[i] <= m.hba_ub) && (m.psa_lb <= psa[i]) && (psa[i] <= m.psa_ub) && (m.chg_lb <= chg[i]) && (chg[i] <= m.chg_ub) && (m.nrb_lb <= nrb[i]) && (nrb[i] <= m.nrb_ub)) ++ligands;
-				}
-				this.send({uuid: m.uuid, ligands: ligands});
+	// Spawn the idock query process, which maps the columnar index of ligand properties precomputed by idock/bin/encode and counts ligands satisfying filtering conditions line by line
+	// A failed query process is respawned after a delay that doubles up to a minute, so that a missing binary or index does not spin, and pending and further queries are answered with an error meanwhile
+	var readline = require('readline'), spawn = require('child_process').spawn;
+	var pending = [], query, queryDelay = 1000, queryError = 'the ligand property index is unavailable, please try again later';
+	var failQueries = function() {
+		pending.forEach(function(p) {
+			p.worker.send({uuid: p.uuid, ligands: -1, error: queryError});
+		});
+		pending = [];
+	};
+	var spawnQuery = function() {
+		console.log('Spawning idock/bin/query');
+		var child = query = spawn('bin/query', ['16'], { cwd: 'idock' });
+		var respawn = function(reason) {
+			if (query !== child) return;
+			query = undefined;
+			console.error('Query process %s. Respawning in %d seconds...', reason, queryDelay / 1000);
+			failQueries();
+			setTimeout(spawnQuery, queryDelay);
+			queryDelay = Math.min(queryDelay * 2, 60000);
+		};
+		child.on('error', function(err) {
+			respawn('failed: ' + err.message);
+		});
+		child.stdin.on('error', function(err) {
+			respawn('stopped reading queries: ' + err.message);
+		});
+		readline.createInterface({ input: child.stderr }).on('line', function(line) {
+			console.error('Query process: %s', line);
+		});
+		readline.createInterface({ input: child.stdout }).on('line', function(line) {
+			queryDelay = 1000;
+			var p = pending.shift();
+			if (p) p.worker.send({uuid: p.uuid, ligands: parseInt(line)});
+		});
+		child.on('exit', function(code) {
+			respawn('exited with code ' + code);
+		});
+	};
+	spawnQuery();
+	// Fork worker processes with cluster
+	var numCPUs = require('os').cpus().length;
+	console.log('Forking %d worker processes', numCPUs);
+	var msg = function(m) {
+		if (m.query == '/idock/ligands') {
+			if (!query) {
+				this.send({uuid: m.uuid, ligands: -1, error: queryError});
+				return;
 			}
+			pending.push({worker: this, uuid: m.uuid});
+			query.stdin.write([m.mwt_lb, m.mwt_ub, m.lgp_lb, m.lgp_ub, m.ads_lb, m.ads_ub, m.pds_lb, m.pds_ub, m.hbd_lb, m.hbd_ub, m.hba_lb, m.hba_ub, m.psa_lb, m.psa_ub, m.chg_lb, m.chg_ub, m.nrb_lb, m.nrb_ub].join(' ') + '\n');
 		}
-		for (var i = 0; i < numCPUs; i++) {
-			cluster.fork().on('message', msg);
-		}
-		cluster.on('death', function(worker) {
-			console.error('Worker process %d died. Restarting...', worker.pid);
-			cluster.fork().on('message', msg);
-		});
+	}
+	for (var i = 0; i < numCPUs; i++) {
+		cluster.fork().on('message', msg);
+	}
+	cluster.on('death', function(worker) {
+		console.error('Worker process %d died. Restarting...', worker.pid);
+		cluster.fork().on('message', msg);
 	});
 } else {
 	// Connect to MongoDB
@@ -93,7 +104,7 @@ if (cluster.isMaster) {
 				if (msg.uuid !== m_uuid) setImmediate(function() {
 					sync(m_uuid, callback);
 				});
-				else callback(msg.ligands);
+				else callback(msg.ligands, msg.error);
 			};
 			process.on('message', function(m) {
 				if (m.ligands !== undefined) {
@@ -153,11 +164,13 @@ if (cluster.isMaster) {
 				'submitted': 1,
 				'scheduled': 1,
 				'completed': 1,
+				'partial_hits': 1,
 			};
 			var idockProgressFields = {
 				'_id': 0,
 				'scheduled': 1,
 				'completed': 1,
+				'partial_hits': 1,
 			};
 			for (var i = 0; i < 10; ++i) {
 				idockJobFields[i] = 1;
@@ -234,7 +247,11 @@ if (cluster.isMaster) {
 					nrb_lb: v.res.nrb_lb,
 					nrb_ub: v.res.nrb_ub
 				});
-				sync(m_uuid, function(ligands) {
+				sync(m_uuid, function(ligands, error) {
+					if (error) {
+						res.json({'ligands': error});
+						return;
+					}
 					if (!(1 <= ligands)) {
 						res.json({'ligands': 'the number of filtered ligands must be at least 1'});
 						return;
@@ -317,7 +334,11 @@ if (cluster.isMaster) {
 				v.res.query = '/idock/ligands';
 				v.res.uuid = uuid.v1();
 				process.send(v.res);
-				sync(v.res.uuid, function(ligands) {
+				sync(v.res.uuid, function(ligands, error) {
+					if (error) {
+						res.status(503).json(error);
+						return;
+					}
 					res.json(ligands);
 				});
 			});